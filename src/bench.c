@@ -0,0 +1,244 @@
+/******************************************************************************
+ * $Id$
+ * Project: Vapor Chess
+ * Purpose: Search benchmark on a fixed set of positions.
+ * 
+ * Copyright 2012 by Michael Leany
+ * All rights reserved
+ */
+
+#include "bench.h"
+#include "search.h"
+#include "game.h"
+#include "hash.h"
+#include "microtime.h"
+#include "fen.h"
+#include "moves.h"
+#include "eval.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BENCH_HASH_SIZE 0x1000000 // 16MB
+#define EVAL_BENCH_PLIES 2          // plies of positions to evaluate
+
+static const char *const BENCH_FENS[] = {
+  "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+  "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+  "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+  "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+  "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+  "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+  "r1bq1rk1/pp2bppp/2n1pn2/3p4/2PP4/2N1PN2/PP2BPPP/R2QKB1R w KQ - 0 8",
+  "2r3k1/pp3ppp/4p3/3pP3/3P1P2/P3K3/1P4PP/2R5 w - - 0 25",
+  NULL
+};
+
+/******************************************************************************
+ * int benchRun(int Depth, int Verbose, int64 *Nodes, microtime *Time);
+ * PARAMETERS
+ *    Depth - the depth to search each position to.
+ *    Verbose - non-zero to print the results for each position.
+ *    Nodes - receives the total number of nodes searched.
+ *    Time - receives the total time taken.
+ * DESCRIPTION
+ *    Searches each of the benchmark positions with a fresh hash.
+ * RETURN VALUE
+ *    Returns 0 on success or 1 on failure.
+ */
+static int benchRun(int Depth, int Verbose, int64 *Nodes, microtime *Time)
+{
+  *Nodes = 0;
+  *Time = 0;
+  for (int i = 0; BENCH_FENS[i]; i++)
+  {
+    if (setGamePos(BENCH_FENS[i]) != 0)
+    {
+      fprintf(stderr, "Invalid FEN:\n  %s\n", BENCH_FENS[i]);
+      return 1;
+    }
+
+    freeHash();
+    if (!initHash(BENCH_HASH_SIZE, SearchThreads))
+    {
+      fprintf(stderr, "Cannot allocate hash table\n");
+      return 1;
+    }
+
+    searchRoot();
+    if (Verbose)
+      printf("Position %i: %12"_i64" nodes  %"_i64".%.3"_i64"s  %s\n", i+1,
+          PVData.Nodes, toSeconds(PVData.Time), mSecPart(PVData.Time),
+          BENCH_FENS[i]);
+    *Nodes += PVData.Nodes;
+    *Time += PVData.Time;
+  }
+  freeHash();
+
+  return 0;
+}
+
+int bench(int Depth, int Threads)
+{
+  int64 TotalNodes;
+  microtime Time, BaseTime = 0;
+  int n;
+
+  memset(&Search, 0, sizeof(Search));
+  Search.MaxDepth = Depth;
+  printPV = NULL;
+  checkInput = NULL;
+
+  if (Threads <= 1)
+  {
+    if (benchRun(Depth, 1, &TotalNodes, &Time) != 0)
+      return 1;
+    printf("\nDepth: %i \tNodes: %"_i64" \tTime: %"_i64".%.3"_i64"s \t",
+        Depth, TotalNodes, toSeconds(Time), mSecPart(Time));
+    if (Time)
+      printf("Rate: %"_i64" n/s\n", (TotalNodes*ONE_SEC)/Time);
+    else
+      printf("Rate: %"_i64"+ n/s\n", TotalNodes);
+    return 0;
+  }
+
+  // time-to-depth for 1, 2, 4, ... threads, up to Threads
+  printf("Depth: %i \tSMP mode: %s\n\n", Depth,
+      (SMPMode == SMP_YBWC)? "ybwc" : "lazy");
+  printf("Threads %14s %10s %14s %8s\n", "Nodes", "Time", "Rate", "Speedup");
+  for (n = 1; ; n = min(2*n, Threads))
+  {
+    SearchThreads = n;
+    if (benchRun(Depth, 0, &TotalNodes, &Time) != 0)
+      return 1;
+    if (n == 1)
+      BaseTime = Time;
+    printf("%7i %14"_i64" %6"_i64".%.3"_i64"s %12"_i64"/s ", n, TotalNodes,
+        toSeconds(Time), mSecPart(Time),
+        Time? (TotalNodes*ONE_SEC)/Time : TotalNodes);
+    if (Time)
+      printf("%7.2fx\n", (double)BaseTime/Time);
+    else
+      printf("%8s\n", "-");
+    fflush(stdout);
+    if (n == Threads)
+      break;
+  }
+  SearchThreads = 1;
+
+  return 0;
+}
+
+/* positions gathered for the evaluation benchmark */
+typedef struct eval_positions {
+  position *Pos;
+  int Count;
+  int Size;
+} eval_positions;
+
+/******************************************************************************
+ * int gatherPositions(position *Pos, int Depth, eval_positions *List);
+ * PARAMETERS
+ *    Pos - the position to start from.
+ *    Depth - the number of plies to gather positions to.
+ *    List - the list to add Pos and the positions reached from it to.
+ * DESCRIPTION
+ *    Adds Pos and every position up to Depth plies from it to List.
+ * RETURN VALUE
+ *    Returns 0 on success or 1 if memory couldn't be allocated.
+ */
+static int gatherPositions(position *Pos, int Depth, eval_positions *List)
+{
+  const int MvBase = getMoveStackTop();
+  position *NewList;
+  checkinfo CI;
+  undo Undo;
+  move Move;
+  int nMoves;
+  int Failed = 0;
+
+  if (List->Count == List->Size)
+  {
+    NewList = realloc(List->Pos, 2*List->Size*sizeof(position));
+    if (!NewList)
+      return 1;
+    List->Pos = NewList;
+    List->Size *= 2;
+  }
+  List->Pos[List->Count++] = *Pos;
+
+  if (Depth == 0)
+    return 0;
+
+  if (Pos->Flags & PF_CHECK)
+    nMoves = genCheckEvasions(Pos);
+  else
+  {
+    getCheckInfo(Pos, &CI);
+    nMoves = genCaptures(Pos, &CI) + genQuietMoves(Pos, &CI);
+  }
+
+  for (int i = 0; i < nMoves && !Failed; i++)
+  {
+    Move = MoveStack[MvBase + i];
+    if (makeMove(Pos, Move, &Undo) == 0)
+    {
+      Failed = gatherPositions(Pos, Depth-1, List);
+      unmakeMove(Pos, Move, &Undo);
+    }
+  }
+  popMoveStack(MvBase);
+
+  return Failed;
+}
+
+int evalBench(void)
+{
+  eval_positions List = { NULL, 0, 1024 };
+  position Pos;
+  microtime Time;
+  int64 Evals = 0;
+  int64 Sum = 0;
+
+  List.Pos = malloc(List.Size*sizeof(position));
+  if (!List.Pos)
+  {
+    fprintf(stderr, "Cannot allocate positions\n");
+    return 1;
+  }
+  for (int i = 0; BENCH_FENS[i]; i++)
+  {
+    if (importFEN(&Pos, BENCH_FENS[i]) != 0)
+    {
+      fprintf(stderr, "Invalid FEN:\n  %s\n", BENCH_FENS[i]);
+      free(List.Pos);
+      return 1;
+    }
+    if (gatherPositions(&Pos, EVAL_BENCH_PLIES, &List) != 0)
+    {
+      fprintf(stderr, "Cannot allocate positions\n");
+      free(List.Pos);
+      return 1;
+    }
+  }
+
+  Time = getMicroTime();
+  do {
+    Sum = 0;
+    for (int i = 0; i < List.Count; i++)
+      Sum += evaluate(&List.Pos[i]);
+    Evals += List.Count;
+  } while (getMicroTime() - Time < ONE_SEC);
+  Time = getMicroTime() - Time;
+
+  printf("Positions: %i \tScore sum: %"_i64"\n", List.Count, Sum);
+  printf("Evaluations: %"_i64" \tTime: %"_i64".%.3"_i64"s \t"
+      "Rate: %"_i64" evals/s\n", Evals, toSeconds(Time), mSecPart(Time),
+      (Evals*ONE_SEC)/Time);
+
+  free(List.Pos);
+  return 0;
+}
+
+/* end of file */
@@ -0,0 +1,48 @@
+/******************************************************************************
+ * $Id$
+ * Project: Vapor Chess
+ * Purpose: Search benchmark on a fixed set of positions.
+ * 
+ * Copyright 2012 by Michael Leany
+ * All rights reserved
+ */
+
+#ifndef VAPOR__BENCH_H
+#define VAPOR__BENCH_H
+
+#include "vapor.h"
+
+#define BENCH_DEPTH 7 // default search depth for the benchmark
+
+/******************************************************************************
+ * int bench(int Depth, int Threads);
+ * PARAMETERS
+ *    Depth - the depth to search each position to.
+ *    Threads - the most threads to search with.
+ * DESCRIPTION
+ *    Searches each position of a fixed set to Depth with a fresh hash table,
+ *    printing the nodes searched for each and in total. Since the positions
+ *    and depth are fixed, the node counts measure the effect of changes to
+ *    move ordering and pruning. With more than one thread, the whole set is
+ *    searched with 1, 2, 4, ... up to Threads threads instead, reporting the
+ *    time-to-depth and speedup of each.
+ * RETURN VALUE
+ *    Returns 0 upon success or 1 upon failure.
+ */
+int bench(int Depth, int Threads);
+
+/******************************************************************************
+ * int evalBench(void);
+ * DESCRIPTION
+ *    Collects the positions up to two plies from each benchmark position,
+ *    then evaluates them over and over for at least a second, printing the
+ *    number of evaluations per second. The sum of the scores is printed as
+ *    well, so that changes to the evaluation itself can be spotted.
+ * RETURN VALUE
+ *    Returns 0 upon success or 1 upon failure.
+ */
+int evalBench(void);
+
+#endif // #ifndef VAPOR__BENCH_H
+
+/* end of file */
@@ -42,6 +42,14 @@ typedef enum piece
 } piece;
 #define NUM_PIECES (KING)
 
+/* stage indicates the stage of the game a score applies to */
+typedef enum stage
+{
+  MIDGAME,
+  ENDGAME,
+} stage;
+#define NUM_STAGES (ENDGAME + 1)
+
 /******************************************************************************
  * the position
  */
@@ -53,6 +61,7 @@ typedef uint64 zobrist;
 typedef struct position
 {
   zobrist ZKey;
+  zobrist PawnKey;  // key of the pawns alone, for the pawn hash
   bitboard Occ;
   bitboard OccBy[NUM_COLORS][NUM_PIECES + 1];
 
@@ -64,6 +73,10 @@ typedef struct position
   int DrawPlies;    // number of plies that count toward a 50 move draw
   int MoveNum;      // full-move number of the next move starting with 1
 
+  int PcSqScore[NUM_STAGES];  // material and piece-square values of white's
+                              // pieces minus those of black's
+  int Phase;        // game phase, from the pieces left on the board
+
 } position;
 
 /* position flags */
@@ -95,21 +108,81 @@ typedef enum movetype
   MT_CASTLE,
   MT_ADVANCE2,
 
-  MT_INVALID = -1
+  MT_INVALID      // last so that it still fits in the move's type field
 } movetype;
 
-/* move stores basic information about a move */ 
-typedef struct move
+/* move packs the basic information about a move into 32 bits:
+ *   bits  0-2  the piece promoted to (NO_PIECE if not applicable)
+ *   bits  3-8  destination square
+ *   bits 9-14  origin square
+ *  bits 16-18  moved piece
+ *  bits 19-21  the captured piece (NO_PIECE if not applicable)
+ *  bits 22-23  type of move
+ * so that the low 16 bits are the move's hashmove.
+ */
+typedef uint32 move;
+
+#define NO_MOVE       0
+#define INVALID_MOVE  ((move)MT_INVALID << 22)
+
+static inline move packMove(piece Piece, square Orig, square Dest,
+    piece CaptPc, piece PromPc, movetype Type)
 {
-  piece Piece;    // moved piece
-  piece CaptPc;   // the captured piece (NO_PIECE if not applicable)
-  piece PromPc;   // the piece promoted to (NO_PIECE if not applicable)
+  return (move)PromPc | ((move)Dest << 3) | ((move)Orig << 9)
+      | ((move)Piece << 16) | ((move)CaptPc << 19) | ((move)Type << 22);
+}
 
-  square Orig;    // origin square
-  square Dest;    // destination square
+static inline piece getPromPc(move Move)
+{
+  return (piece)(Move & 7);
+}
+
+static inline square getDest(move Move)
+{
+  return (square)((Move >> 3) & 077);
+}
 
-  movetype Type;  // type of move
-} move;
+static inline square getOrig(move Move)
+{
+  return (square)((Move >> 9) & 077);
+}
+
+static inline piece getPiece(move Move)
+{
+  return (piece)((Move >> 16) & 7);
+}
+
+static inline piece getCaptPc(move Move)
+{
+  return (piece)((Move >> 19) & 7);
+}
+
+static inline movetype getMoveType(move Move)
+{
+  return (movetype)((Move >> 22) & 3);
+}
+
+static inline move setPromPc(move Move, piece PromPc)
+{
+  return (Move & ~(move)7) | PromPc;
+}
+
+static inline hashmove getHashMove(move Move)
+{
+  return (hashmove)Move;
+}
+
+/* undo stores what a move destroys so that it can be taken back */
+typedef struct undo
+{
+  zobrist ZKey;
+  zobrist PawnKey;
+  uint32 Flags;
+  square EPSquare;
+  int DrawPlies;
+  int PcSqScore[NUM_STAGES];
+  int Phase;
+} undo;
 
 #endif // #ifndef VAPOR__CHESS_H
 
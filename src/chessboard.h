@@ -63,12 +63,12 @@ typedef uint64 bitboard;
 /* square, file and rank masks */
 #define SQMASK(S) ((bitboard)1 << (S))
 #define SQMASKFR(F, R) (SQMASK(SQUARE((F), (R))))
-#define FILEMASK(F) (0xffLL << ((F)*8))
-#define RANKMASK(R) (0x0101010101010101 << (R))
+#define FILEMASK(F) (0xffULL << ((F)*8))
+#define RANKMASK(R) (0x0101010101010101ULL << (R))
 
 /* diagonal and antidiagonal masks */
-extern const bitboard DIAGMASK[NUM_SQUARES];      // a1 to h8 direction
-extern const bitboard ANTIDIAGMASK[NUM_SQUARES];  // a8 to h1 direction
+extern bitboard DIAGMASK[NUM_SQUARES];      // a1 to h8 direction
+extern bitboard ANTIDIAGMASK[NUM_SQUARES];  // a8 to h1 direction
 
 /* square testing */
 #define TESTSQ(B, S) ((B) & SQMASK(S))
@@ -86,28 +86,65 @@ extern const bitboard ANTIDIAGMASK[NUM_SQUARES];  // a8 to h1 direction
 #define LSB(B)      ((B) & -(B))
 #define CLEARLSB(B) ((B) &= ((B)-1))
 
+/* set by init() if the processor has the popcnt instruction */
+extern int HasPopcnt;
+
 /******************************************************************************
- * int popCnt(register bitboard Bd);
+ * int popCntSoft(bitboard Bd);
  * PARAMETERS
  *    Bd - The bitboard to search.
  * DESCRIPTION
- *    Determines the number of bits set in Bd.
+ *    Determines the number of bits set in Bd without using any special
+ *    instructions, by summing bits in parallel within each byte.
  * RETURN VALUE
  *    Returns the number of bits.
  */
-static inline int popCnt(register bitboard Bd)
+static inline int popCntSoft(bitboard Bd)
 {
-  register int Cnt = 0;
+  Bd = Bd - ((Bd >> 1) & 0x5555555555555555ULL);
+  Bd = (Bd & 0x3333333333333333ULL) + ((Bd >> 2) & 0x3333333333333333ULL);
+  Bd = (Bd + (Bd >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+  return (int)((Bd * 0x0101010101010101ULL) >> 56);
+}
 
-  while (Bd)
+/******************************************************************************
+ * int popCnt(bitboard Bd);
+ * PARAMETERS
+ *    Bd - The bitboard to search.
+ * DESCRIPTION
+ *    Determines the number of bits set in Bd. When compiled for a processor
+ *    with popcnt (e.g. -mpopcnt or -march=native) this is one instruction.
+ *    Otherwise on AMD64 machines the instruction is used if init() found it,
+ *    and popCntSoft() is used if not.
+ * RETURN VALUE
+ *    Returns the number of bits.
+ * PORTABILITY ISSUES
+ *    Contains gcc-specific code.
+ */
+#if defined(__POPCNT__)
+static inline int popCnt(bitboard Bd)
+{
+  return __builtin_popcountll(Bd);
+}
+#elif defined(__x86_64__)
+static inline int popCnt(bitboard Bd)
+{
+  uint64 Cnt;  // must be 64-bit for assembly instruction
+
+  if (HasPopcnt)
   {
-    Cnt++;
-    CLEARLSB(Bd);
+    asm("popcnt %1, %0" : "=r" (Cnt) : "rm" (Bd));
+    return (int)Cnt;
   }
-
-  return Cnt;
+  else
+    return popCntSoft(Bd);
 }
-
+#else // neither __POPCNT__ nor __x86_64__ defined
+static inline int popCnt(bitboard Bd)
+{
+  return popCntSoft(Bd);
+}
+#endif // #if defined(__POPCNT__)
 
 /******************************************************************************
  * square firstSq(bitboard Bd);
@@ -116,13 +153,23 @@ static inline int popCnt(register bitboard Bd)
  * DESCRIPTION
  *    Determines the square corresponding to the first (least significant) bit
  *    set in Bd. The least significant bit corresponds to the lowest numerical
- *    rank, within the lowest file alphabetically.
+ *    rank, within the lowest file alphabetically. When compiled for BMI1
+ *    (e.g. -mbmi or -march=native) tzcnt is used, which is defined for an
+ *    empty board, so the result is selected without a branch.
  * RETURN VALUE
- *    Returns the resulting square.
+ *    Returns the resulting square, or NO_SQUARE if Bd is empty.
  * PORTABILITY ISSUES
  *    Contains gcc-specific code.
  */
-#ifdef __x86_64__
+#if defined(__x86_64__) && defined(__BMI__)
+static inline square firstSq(bitboard Bd)
+{
+  uint64 Sq;  // must be 64-bit for assembly instruction
+
+  asm("tzcnt %1, %0" : "=r" (Sq) : "rm" (Bd));
+  return (Sq < NUM_SQUARES)? (square)Sq : NO_SQUARE;
+}
+#elif defined(__x86_64__)
 static inline square firstSq(bitboard Bd)
 {
   uint64 Sq;  // must be 64-bit for assembly instruction
@@ -155,7 +202,7 @@ static inline square firstSq(bitboard Bd)
   else
     return NO_SQUARE;
 }
-#endif // #ifdef __x86_64__
+#endif // #if defined(__x86_64__) && defined(__BMI__)
 
 /******************************************************************************
  * square lastSq(bitboard Bd);
@@ -164,13 +211,23 @@ static inline square firstSq(bitboard Bd)
  * DESCRIPTION
  *    Determines the square corresponding to the last (most significant) bit
  *    set in Bd. The most significant bit corresponds to the highest numerical
- *    rank, within the highest file alphabetically.
+ *    rank, within the highest file alphabetically. When compiled for lzcnt
+ *    (e.g. -mlzcnt or -march=native), an empty board gives a count of 64, so
+ *    NO_SQUARE falls out of the subtraction without a branch.
  * RETURN VALUE
- *    Returns the resulting square.
+ *    Returns the resulting square, or NO_SQUARE if Bd is empty.
  * PORTABILITY ISSUES
  *    Contains gcc-specific code.
  */
-#ifdef __x86_64__
+#if defined(__x86_64__) && defined(__LZCNT__)
+static inline square lastSq(bitboard Bd)
+{
+  uint64 Cnt;  // must be 64-bit for assembly instruction
+
+  asm("lzcnt %1, %0" : "=r" (Cnt) : "rm" (Bd));
+  return (square)(h8 - (int)Cnt);
+}
+#elif defined(__x86_64__)
 static inline square lastSq(bitboard Bd)
 {
   uint64 Sq;  // must be 64-bit for assembly instruction
@@ -193,18 +250,17 @@ static inline square lastSq(bitboard Bd)
   if (Hi)
   {
     asm("bsr %1, %0" : "=r" (Sq) : "rm" (Hi));
-    return (square)Sq;
+    return (square)(Sq + 32);
   }
   else if (Lo)
   {
-    // NOTE: will only work as written on AMD64 machines and is gcc specific
     asm("bsr %1, %0" : "=r" (Sq) : "rm" (Lo));
-    return (square)(Sq + 32);
+    return (square)Sq;
   }
   else
     return NO_SQUARE;
 }
-#endif // #ifdef __x86_64__
+#endif // #if defined(__x86_64__) && defined(__LZCNT__)
 
 /******************************************************************************
  * bitboard flipBd(bitboard Bd);
@@ -238,6 +294,31 @@ static inline bitboard flipBd(bitboard Bd)
 }
 #endif // #ifdef __x86_64__
 
+/******************************************************************************
+ * bitboard pextBd(bitboard Bd, bitboard Mask);
+ * PARAMETERS
+ *    Bd - board from which bits are extracted.
+ *    Mask - the bits to extract.
+ * DESCRIPTION
+ *    Gathers the bits of Bd selected by Mask into the low-order bits of the
+ *    result, preserving their order.
+ * RETURN VALUE
+ *    Returns the extracted bits.
+ * PORTABILITY ISSUES
+ *    Contains gcc-specific code. Only available on AMD64 machines, and only
+ *    to be called on processors supporting BMI2 (see hasBMI2()).
+ */
+#ifdef __x86_64__
+static inline bitboard pextBd(bitboard Bd, bitboard Mask)
+{
+  bitboard Result;
+
+  asm("pext %2, %1, %0" : "=r" (Result) : "r" (Bd), "rm" (Mask));
+
+  return Result;
+}
+#endif // #ifdef __x86_64__
+
 #endif // #ifndef VAPOR__BOARD_H
 
 /* end of file */
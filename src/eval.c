@@ -8,68 +8,493 @@
  */
 
 #include "eval.h"
+#include "moves.h"
 
+/* pawn structure terms */
+#define DOUBLED_PAWN   -10
+#define ISOLATED_PAWN  -12
+#define BACKWARD_PAWN   -8
+static const int PassedPawn[NUM_RANKS] = { 0, 0, 5, 10, 20, 35, 55, 0 };
+
+/* mobility: the value of each safe square a piece attacks, and the number of
+ * safe squares that scores zero */
+static const int Mobility[NUM_STAGES][NUM_PIECES] = {
+  { 0, 0, 4, 5, 2, 1 }, // MIDGAME
+  { 0, 0, 4, 5, 4, 2 }, // ENDGAME
+};
+static const int MobilityBase[NUM_PIECES] = { 0, 0, 4, 6, 7, 13 };
+
+/* king safety: the weight of each attack on a square next to the king, and
+ * the midgame penalty per weighted attack */
+static const int KingAttack[NUM_PIECES] = { 0, 1, 2, 2, 3, 5 };
+#define KING_DANGER     -4
+
+/* threats: a piece (other than a pawn or king) attacked by a pawn */
+#define THREAT_BY_PAWN  20
+
+/* attack maps and scores built up while evaluating a position */
+typedef struct eval_info {
+  bitboard Attacks[NUM_COLORS][NUM_PIECES+1]; // by piece, 0 for all pieces
+  int Score[NUM_STAGES];                      // white's minus black's
+} eval_info;
+
+/* pawn hash: each thread caches the pawn structures it has evaluated */
+#define PAWN_HASH_SIZE 0x4000 // entries
+typedef struct pawn_entry {
+  zobrist PawnKey;
+  bitboard Passed;                // passed pawns of both colors
+  bitboard Attacks[NUM_COLORS];   // squares attacked by each color's pawns
+  int Score;                      // for white
+} pawn_entry;
+// NOTE: a cleared entry is correct as it is for positions without pawns
+static THREAD_LOCAL pawn_entry PawnHash[PAWN_HASH_SIZE];
+
+/* material: PieceVal is for the midgame, and is used by the search too */
 const int PieceVal[NUM_PIECES] = { 0, 100, 320, 330, 500, 1000 };
+static const int EndgamePieceVal[NUM_PIECES] = { 0, 120, 310, 330, 530, 1000 };
 
-int PcSqVal[NUM_PIECES][NUM_SQUARES] = {
+/* how much each piece counts toward the game phase */
+const int PHASE_WEIGHT[NUM_PIECES+1] = { 0, 0, 1, 1, 2, 4, 0 };
+
+static const int PcSqVal[NUM_STAGES][NUM_PIECES+1][NUM_SQUARES] = {
+  // MIDGAME
+  {
     // NO_PIECE
     { 0 },
     // PAWN
     {
-    //  1    2    3    4    5    6    7   8
-        0,   5,   4,  -5,   5,  10,  70,  0, // a
-        0,  10,  -5,  -2,   7,  15,  70,  0, // b
-        0,  10,  -5,   2,  10,  20,  70,  0, // c
-        0, -25,   5,  15,  20,  30,  70,  0, // d
-        0, -25,   5,  15,  20,  30,  70,  0, // e
-        0,  10, -10,   0,  10,  20,  70,  0, // f
-        0,  10,  -5,  -2,   7,  15,  70,  0, // g
-        0,   5,   4,  -5,   5,  10,  70,  0, // h
+    //   1    2    3    4    5    6    7    8
+         0,   5,   4,  -5,   5,  10,  70,   0, // a
+         0,  10,  -5,  -2,   7,  15,  70,   0, // b
+         0,  10,  -5,   2,  10,  20,  70,   0, // c
+         0, -25,   5,  15,  20,  30,  70,   0, // d
+         0, -25,   5,  15,  20,  30,  70,   0, // e
+         0,  10, -10,   0,  10,  20,  70,   0, // f
+         0,  10,  -5,  -2,   7,  15,  70,   0, // g
+         0,   5,   4,  -5,   5,  10,  70,   0, // h
     },
     // KNIGHT
     {
-    //    1    2    3    4    5    6    7    8
-        -40, -30, -20, -20, -20, -20, -30, -40, // a
-        -30, -10,   7,   5,   5,   7, -10, -30, // b
-        -20,   0,  10,  15,  15,  12,   0, -20, // c
-        -20,   5,  12,  20,  25,  15,   0, -20, // d
-        -20,   5,  12,  20,  25,  15,   0, -20, // e
-        -20,   0,  10,  15,  15,  12,   0, -20, // f
-        -30, -10,   7,   5,   5,   7, -10, -30, // g
-        -40, -30, -20, -20, -20, -20, -30, -40, // h
+    //   1    2    3    4    5    6    7    8
+       -40, -30, -20, -20, -20, -20, -30, -40, // a
+       -30, -10,   7,   5,   5,   7, -10, -30, // b
+       -20,   0,  10,  15,  15,  12,   0, -20, // c
+       -20,   5,  12,  20,  25,  15,   0, -20, // d
+       -20,   5,  12,  20,  25,  15,   0, -20, // e
+       -20,   0,  10,  15,  15,  12,   0, -20, // f
+       -30, -10,   7,   5,   5,   7, -10, -30, // g
+       -40, -30, -20, -20, -20, -20, -30, -40, // h
+    },
+    // BISHOP
+    {
+    //   1    2    3    4    5    6    7    8
+       -20, -10, -10, -10, -10, -10, -10, -20, // a
+       -10,   5,  10,   0,   5,   0,   0, -10, // b
+       -10,   0,  10,  10,   5,   5,   0, -10, // c
+       -10,   0,  10,  10,  10,  10,   0, -10, // d
+       -10,   0,  10,  10,  10,  10,   0, -10, // e
+       -10,   0,  10,  10,   5,   5,   0, -10, // f
+       -10,   5,  10,   0,   5,   0,   0, -10, // g
+       -20, -10, -10, -10, -10, -10, -10, -20, // h
+    },
+    // ROOK
+    {
+    //   1    2    3    4    5    6    7    8
+         0,  -5,  -5,  -5,  -5,  -5,   5,   0, // a
+         0,   0,   0,   0,   0,   0,  10,   0, // b
+         0,   0,   0,   0,   0,   0,  10,   0, // c
+         5,   0,   0,   0,   0,   0,  10,   0, // d
+         5,   0,   0,   0,   0,   0,  10,   0, // e
+         0,   0,   0,   0,   0,   0,  10,   0, // f
+         0,   0,   0,   0,   0,   0,  10,   0, // g
+         0,  -5,  -5,  -5,  -5,  -5,   5,   0, // h
+    },
+    // QUEEN
+    {
+    //   1    2    3    4    5    6    7    8
+       -20, -10, -10,   0,  -5, -10, -10, -20, // a
+       -10,   0,   5,   0,   0,   0,   0, -10, // b
+       -10,   5,   5,   5,   5,   5,   0, -10, // c
+        -5,   0,   5,   5,   5,   5,   0,  -5, // d
+        -5,   0,   5,   5,   5,   5,   0,  -5, // e
+       -10,   0,   5,   5,   5,   5,   0, -10, // f
+       -10,   0,   0,   0,   0,   0,   0, -10, // g
+       -20, -10, -10,  -5,  -5, -10, -10, -20, // h
+    },
+    // KING
+    {
+    //   1    2    3    4    5    6    7    8
+        20,  20, -10, -20, -30, -30, -30, -30, // a
+        30,  20, -20, -30, -40, -40, -40, -40, // b
+        10,   0, -20, -30, -40, -40, -40, -40, // c
+         0,   0, -20, -40, -50, -50, -50, -50, // d
+         0,   0, -20, -40, -50, -50, -50, -50, // e
+        10,   0, -20, -30, -40, -40, -40, -40, // f
+        30,  20, -20, -30, -40, -40, -40, -40, // g
+        20,  20, -10, -20, -30, -30, -30, -30, // h
+    },
+  },
+  // ENDGAME
+  {
+    // NO_PIECE
+    { 0 },
+    // PAWN
+    {
+    //   1    2    3    4    5    6    7    8
+         0,   0,   2,   5,  12,  25,  50,   0, // a
+         0,   0,   2,   5,  12,  25,  50,   0, // b
+         0,   0,   2,   5,  12,  25,  50,   0, // c
+         0,   0,   2,   5,  12,  25,  50,   0, // d
+         0,   0,   2,   5,  12,  25,  50,   0, // e
+         0,   0,   2,   5,  12,  25,  50,   0, // f
+         0,   0,   2,   5,  12,  25,  50,   0, // g
+         0,   0,   2,   5,  12,  25,  50,   0, // h
+    },
+    // KNIGHT
+    {
+    //   1    2    3    4    5    6    7    8
+       -30, -30, -30, -30, -30, -30, -30, -30, // a
+       -30, -10, -10, -10, -10, -10, -10, -30, // b
+       -30, -10,   5,   5,   5,   5, -10, -30, // c
+       -30, -10,   5,  15,  15,   5, -10, -30, // d
+       -30, -10,   5,  15,  15,   5, -10, -30, // e
+       -30, -10,   5,   5,   5,   5, -10, -30, // f
+       -30, -10, -10, -10, -10, -10, -10, -30, // g
+       -30, -30, -30, -30, -30, -30, -30, -30, // h
+    },
+    // BISHOP
+    {
+    //   1    2    3    4    5    6    7    8
+       -15, -15, -15, -15, -15, -15, -15, -15, // a
+       -15,  -5,  -5,  -5,  -5,  -5,  -5, -15, // b
+       -15,  -5,   5,   5,   5,   5,  -5, -15, // c
+       -15,  -5,   5,  10,  10,   5,  -5, -15, // d
+       -15,  -5,   5,  10,  10,   5,  -5, -15, // e
+       -15,  -5,   5,   5,   5,   5,  -5, -15, // f
+       -15,  -5,  -5,  -5,  -5,  -5,  -5, -15, // g
+       -15, -15, -15, -15, -15, -15, -15, -15, // h
+    },
+    // ROOK
+    {
+    //   1    2    3    4    5    6    7    8
+         0,   0,   0,   0,   0,   0,  10,   0, // a
+         0,   0,   0,   0,   0,   0,  10,   0, // b
+         0,   0,   0,   0,   0,   0,  10,   0, // c
+         0,   0,   0,   0,   0,   0,  10,   0, // d
+         0,   0,   0,   0,   0,   0,  10,   0, // e
+         0,   0,   0,   0,   0,   0,  10,   0, // f
+         0,   0,   0,   0,   0,   0,  10,   0, // g
+         0,   0,   0,   0,   0,   0,  10,   0, // h
+    },
+    // QUEEN
+    {
+    //   1    2    3    4    5    6    7    8
+       -10, -10, -10, -10, -10, -10, -10, -10, // a
+       -10,   0,   0,   0,   0,   0,   0, -10, // b
+       -10,   0,   5,   5,   5,   5,   0, -10, // c
+       -10,   0,   5,  10,  10,   5,   0, -10, // d
+       -10,   0,   5,  10,  10,   5,   0, -10, // e
+       -10,   0,   5,   5,   5,   5,   0, -10, // f
+       -10,   0,   0,   0,   0,   0,   0, -10, // g
+       -10, -10, -10, -10, -10, -10, -10, -10, // h
+    },
+    // KING
+    {
+    //   1    2    3    4    5    6    7    8
+       -50, -30, -30, -30, -30, -30, -30, -50, // a
+       -30, -30, -10, -10, -10, -10, -20, -40, // b
+       -30,   0,  20,  30,  30,  20, -10, -30, // c
+       -30,   0,  30,  40,  40,  30,   0, -20, // d
+       -30,   0,  30,  40,  40,  30,   0, -20, // e
+       -30,   0,  20,  30,  30,  20, -10, -30, // f
+       -30, -30, -10, -10, -10, -10, -20, -40, // g
+       -50, -30, -30, -30, -30, -30, -30, -50, // h
     },
+  },
 };
 
-int evaluate(const position *Pos)
+/******************************************************************************
+ * static inline bitboard pawnAttacks(bitboard Pawns, color Color);
+ * PARAMETERS
+ *    Pawns - pawns of one color.
+ *    Color - their color.
+ * DESCRIPTION
+ *    Finds the squares attacked by Pawns.
+ * RETURN VALUE
+ *    Returns the attacked squares.
+ */
+static inline bitboard pawnAttacks(bitboard Pawns, color Color)
 {
-  int Val[NUM_COLORS] = { 0, 0 };
+  if (Color == WHITE)
+    return (Pawns >> 7) | (Pawns << 9);
+  else
+    return (Pawns >> 9) | (Pawns << 7);
+}
+
+/******************************************************************************
+ * static int evalPawnColor(const position *Pos, color Color, pawn_entry *PE);
+ * PARAMETERS
+ *    Pos - the position.
+ *    Color - the color whose pawns are evaluated.
+ *    PE - the pawn hash entry being filled in, which must already have the
+ *        pawn attacks of both colors. Passed pawns are added to it.
+ * DESCRIPTION
+ *    Scores doubled, isolated, backward and passed pawns of one color.
+ * RETURN VALUE
+ *    Returns the score for Color.
+ */
+static int evalPawnColor(const position *Pos, color Color, pawn_entry *PE)
+{
+  const bitboard Pawns = Pos->OccBy[Color][PAWN];
+  const bitboard Enemies = Pos->OccBy[!Color][PAWN];
+  bitboard Bd = Pawns;
+  bitboard Adjacent;
+  bitboard Ahead;   // ranks ahead of the pawn
+  bitboard Behind;  // ranks behind the pawn, and its own rank
+  square Sq;
+  int Rank;         // from Color's point of view
+  int Val = 0;
+
+  while (Bd)
+  {
+    Sq = firstSq(Bd);
+    CLEARLSB(Bd);
+    Adjacent = ((FILE(Sq) > F_a)? FILEMASK(FILE(Sq)-1) : 0)
+        | ((FILE(Sq) < F_h)? FILEMASK(FILE(Sq)+1) : 0);
+    if (Color == WHITE) {
+      Rank = RANK(Sq);
+      Ahead = ((0xffULL << (Rank+1)) & 0xff) * RANKMASK(R_1);
+      Behind = RANKMASK(R_1) * ((2ULL << Rank) - 1);
+    } else {
+      Rank = RANK(Sq^007);
+      Ahead = ((1ULL << RANK(Sq)) - 1) * RANKMASK(R_1);
+      Behind = ((0xffULL << RANK(Sq)) & 0xff) * RANKMASK(R_1);
+    }
+
+    if (Pawns & Ahead & FILEMASK(FILE(Sq)))
+      Val += DOUBLED_PAWN;
+    if (!(Pawns & Adjacent))
+      Val += ISOLATED_PAWN;
+    else if (!(Pawns & Adjacent & Behind)
+        && (PE->Attacks[!Color] & SQMASK((Color == WHITE)? Sq+1 : Sq-1)))
+      Val += BACKWARD_PAWN;
+    if (!(Enemies & Ahead & (Adjacent | FILEMASK(FILE(Sq))))) {
+      Val += PassedPawn[Rank];
+      PE->Passed |= SQMASK(Sq);
+    }
+  }
+
+  return Val;
+}
+
+/******************************************************************************
+ * static const pawn_entry *evalPawns(const position *Pos);
+ * PARAMETERS
+ *    Pos - the position.
+ * DESCRIPTION
+ *    Evaluates the pawn structure of Pos, looking it up in this thread's pawn
+ *    hash first, and storing it there if it wasn't found.
+ * RETURN VALUE
+ *    Returns the pawn hash entry for Pos.
+ */
+static const pawn_entry *evalPawns(const position *Pos)
+{
+  pawn_entry *PE = &PawnHash[Pos->PawnKey & (PAWN_HASH_SIZE-1)];
+
+  if (PE->PawnKey == Pos->PawnKey)
+    return PE;
+
+  PE->PawnKey = Pos->PawnKey;
+  PE->Passed = 0;
+  PE->Attacks[WHITE] = pawnAttacks(Pos->OccBy[WHITE][PAWN], WHITE);
+  PE->Attacks[BLACK] = pawnAttacks(Pos->OccBy[BLACK][PAWN], BLACK);
+  PE->Score = evalPawnColor(Pos, WHITE, PE) - evalPawnColor(Pos, BLACK, PE);
+
+  return PE;
+}
+
+int PCSQ_SCORE[NUM_STAGES][NUM_COLORS][NUM_PIECES+1][NUM_SQUARES];
+
+/******************************************************************************
+ * void initEval(void);
+ * DESCRIPTION
+ *    Builds PCSQ_SCORE from the piece and piece-square values.
+ * RETURN VALUE
+ *    Does not return a value.
+ */
+void initEval(void)
+{
+  int Val;
+
+  for (stage s = MIDGAME; s < NUM_STAGES; s++)
+  {
+    for (piece p = PAWN; p <= KING; p++)
+    {
+      Val = (p == KING)? 0 : (s == MIDGAME)? PieceVal[p] : EndgamePieceVal[p];
+      for (square Sq = a1; Sq < NUM_SQUARES; Sq++)
+      {
+        PCSQ_SCORE[s][WHITE][p][Sq] = Val + PcSqVal[s][p][Sq];
+        PCSQ_SCORE[s][BLACK][p][Sq] = -(Val + PcSqVal[s][p][Sq^007]);
+      }
+    }
+  }
+}
+
+/******************************************************************************
+ * int calcPcSqScore(const position *Pos, stage Stage);
+ * PARAMETERS
+ *    Pos - the position.
+ *    Stage - the stage of the game to score for.
+ * DESCRIPTION
+ *    Sums the material and piece-square values of every piece from scratch.
+ *    Pos->PcSqScore is kept up to date by the moves instead; this is used to
+ *    set it up and to check it.
+ * RETURN VALUE
+ *    Returns the score of white's pieces minus the score of black's.
+ */
+int calcPcSqScore(const position *Pos, stage Stage)
+{
+  int Val = 0;
   square Sq;
   bitboard Bd;
 
-  for (piece p = PAWN; p < KING; p++)
+  for (color c = BLACK; c < NUM_COLORS; c++)
   {
-    Bd = Pos->OccBy[WHITE][p];
-    while (Bd)
+    for (piece p = PAWN; p <= KING; p++)
     {
-      Sq = firstSq(Bd);
-      CLEARLSB(Bd);
-      Val[WHITE] += PieceVal[p];
-      Val[WHITE] += PcSqVal[p][Sq];
+      Bd = Pos->OccBy[c][p];
+      while (Bd)
+      {
+        Sq = firstSq(Bd);
+        CLEARLSB(Bd);
+        Val += PCSQ_SCORE[Stage][c][p][Sq];
+      }
     }
-    Bd = Pos->OccBy[BLACK][p];
-    while (Bd)
+  }
+
+  return Val;
+}
+
+/******************************************************************************
+ * int calcPhase(const position *Pos);
+ * PARAMETERS
+ *    Pos - the position.
+ * DESCRIPTION
+ *    Adds up the phase weights of every piece from scratch.
+ * RETURN VALUE
+ *    Returns the game phase, MAX_PHASE for the starting position.
+ */
+int calcPhase(const position *Pos)
+{
+  int Phase = 0;
+
+  for (color c = BLACK; c < NUM_COLORS; c++)
+  {
+    for (piece p = KNIGHT; p < KING; p++)
+      Phase += PHASE_WEIGHT[p] * popCnt(Pos->OccBy[c][p]);
+  }
+
+  return Phase;
+}
+
+/******************************************************************************
+ * static void evalPieces(const position *Pos, const pawn_entry *PE,
+ *     eval_info *EI);
+ * PARAMETERS
+ *    Pos - the position.
+ *    PE - the pawn hash entry for Pos.
+ *    EI - receives the attack maps of both colors, and the scores of the
+ *        terms that use them.
+ * DESCRIPTION
+ *    Builds the attack maps of each color's pieces once, and scores them for
+ *    mobility (squares attacked that are neither occupied by a friendly
+ *    piece nor attacked by an enemy pawn), attacks on the squares around the
+ *    enemy king, and pieces attacked by pawns.
+ * RETURN VALUE
+ *    Does not return a value.
+ */
+static void evalPieces(const position *Pos, const pawn_entry *PE,
+    eval_info *EI)
+{
+  const bitboard Occ = Pos->Occ;
+  bitboard Safe;
+  bitboard Bd;
+  bitboard Att;
+  square Sq;
+  int Sign;
+  int Count;
+
+  EI->Score[MIDGAME] = 0;
+  EI->Score[ENDGAME] = 0;
+
+  for (color c = BLACK; c < NUM_COLORS; c++)
+  {
+    Sign = (c == WHITE)? 1 : -1;
+    Safe = ~Pos->OccBy[c][0] & ~PE->Attacks[!c];
+    EI->Attacks[c][PAWN] = PE->Attacks[c];
+    EI->Attacks[c][KING] = KING_ATT[firstSq(Pos->OccBy[c][KING])];
+    EI->Attacks[c][0] = EI->Attacks[c][PAWN] | EI->Attacks[c][KING];
+
+    for (piece p = KNIGHT; p < KING; p++)
     {
-      Sq = firstSq(Bd);
-      CLEARLSB(Bd);
-      Val[BLACK] += PieceVal[p];
-      Val[BLACK] += PcSqVal[p][Sq^007];
+      EI->Attacks[c][p] = 0;
+      for (Bd = Pos->OccBy[c][p]; Bd; CLEARLSB(Bd))
+      {
+        Sq = firstSq(Bd);
+        if (p == KNIGHT)
+          Att = KNIGHT_ATT[Sq];
+        else if (p == BISHOP)
+          Att = bishopAtt(Occ, Sq);
+        else if (p == ROOK)
+          Att = rookAtt(Occ, Sq);
+        else
+          Att = bishopAtt(Occ, Sq) | rookAtt(Occ, Sq);
+        EI->Attacks[c][p] |= Att;
+
+        Count = popCnt(Att & Safe) - MobilityBase[p];
+        EI->Score[MIDGAME] += Sign * Count * Mobility[MIDGAME][p];
+        EI->Score[ENDGAME] += Sign * Count * Mobility[ENDGAME][p];
+      }
+      EI->Attacks[c][0] |= EI->Attacks[c][p];
     }
+
+    // pieces attacked by pawns, not counting the king
+    Count = popCnt(PE->Attacks[c] & Pos->OccBy[!c][0]
+        & ~(Pos->OccBy[!c][PAWN] | Pos->OccBy[!c][KING]));
+    EI->Score[MIDGAME] += Sign * Count * THREAT_BY_PAWN;
+    EI->Score[ENDGAME] += Sign * Count * THREAT_BY_PAWN;
   }
 
+  // attacks on the squares around each king, with the maps of both colors
+  for (color c = BLACK; c < NUM_COLORS; c++)
+  {
+    Sign = (c == WHITE)? 1 : -1;
+    Count = 0;
+    for (piece p = PAWN; p < KING; p++)
+      Count += KingAttack[p]
+          * popCnt(EI->Attacks[!c][p] & EI->Attacks[c][KING]);
+    EI->Score[MIDGAME] += Sign * Count * KING_DANGER;
+  }
+}
+
+int evaluate(const position *Pos)
+{
+  // blend the midgame and endgame scores by the material left, which can be
+  // over MAX_PHASE after promotions
+  const int Phase = min(Pos->Phase, MAX_PHASE);
+  const pawn_entry *PE = evalPawns(Pos);
+  eval_info EI;
+  int Val;
+
+  evalPieces(Pos, PE, &EI);
+  Val = ((Pos->PcSqScore[MIDGAME] + EI.Score[MIDGAME])*Phase
+      + (Pos->PcSqScore[ENDGAME] + EI.Score[ENDGAME])*(MAX_PHASE - Phase))
+      / MAX_PHASE + PE->Score;
+
   if (Pos->Flags & PF_WHITEMOVE)
-    return Val[WHITE] - Val[BLACK];
+    return Val;
   else
-    return Val[BLACK] - Val[WHITE];
+    return -Val;
 }
 
 /* end of file */
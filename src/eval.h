@@ -15,6 +15,79 @@
 
 extern const int PieceVal[NUM_PIECES];
 
+/* material and piece-square value of each piece on each square, from white's
+ * point of view (so black's values are negative) */
+extern int PCSQ_SCORE[NUM_STAGES][NUM_COLORS][NUM_PIECES+1][NUM_SQUARES];
+
+/* game phase: the sum of PHASE_WEIGHT over the pieces on the board, from
+ * MAX_PHASE at the start of the game toward 0 in the endgame */
+#define MAX_PHASE 24
+extern const int PHASE_WEIGHT[NUM_PIECES+1];
+
+/******************************************************************************
+ * void initEval(void);
+ * DESCRIPTION
+ *    Builds PCSQ_SCORE from the piece and piece-square values.
+ * RETURN VALUE
+ *    Does not return a value.
+ */
+void initEval(void);
+
+/******************************************************************************
+ * int calcPcSqScore(const position *Pos, stage Stage);
+ * PARAMETERS
+ *    Pos - the position.
+ *    Stage - the stage of the game to score for.
+ * DESCRIPTION
+ *    Sums the material and piece-square values of every piece from scratch.
+ * RETURN VALUE
+ *    Returns the score of white's pieces minus the score of black's.
+ */
+int calcPcSqScore(const position *Pos, stage Stage);
+
+/******************************************************************************
+ * int calcPhase(const position *Pos);
+ * PARAMETERS
+ *    Pos - the position.
+ * DESCRIPTION
+ *    Adds up the phase weights of every piece from scratch.
+ * RETURN VALUE
+ *    Returns the game phase, MAX_PHASE for the starting position.
+ */
+int calcPhase(const position *Pos);
+
+/******************************************************************************
+ * static inline void addPcSq(position *Pos, color Color, piece Piece,
+ *     square Sq);
+ * static inline void removePcSq(position *Pos, color Color, piece Piece,
+ *     square Sq);
+ * PARAMETERS
+ *    Pos - the position.
+ *    Color - color of the piece.
+ *    Piece - the piece.
+ *    Sq - the square the piece is put on or taken off of.
+ * DESCRIPTION
+ *    Updates Pos->PcSqScore and Pos->Phase for a piece put on or taken off
+ *    of a square.
+ * RETURN VALUE
+ *    Does not return a value.
+ */
+static inline void addPcSq(position *Pos, color Color, piece Piece,
+    square Sq)
+{
+  Pos->PcSqScore[MIDGAME] += PCSQ_SCORE[MIDGAME][Color][Piece][Sq];
+  Pos->PcSqScore[ENDGAME] += PCSQ_SCORE[ENDGAME][Color][Piece][Sq];
+  Pos->Phase += PHASE_WEIGHT[Piece];
+}
+
+static inline void removePcSq(position *Pos, color Color, piece Piece,
+    square Sq)
+{
+  Pos->PcSqScore[MIDGAME] -= PCSQ_SCORE[MIDGAME][Color][Piece][Sq];
+  Pos->PcSqScore[ENDGAME] -= PCSQ_SCORE[ENDGAME][Color][Piece][Sq];
+  Pos->Phase -= PHASE_WEIGHT[Piece];
+}
+
 int evaluate(const position *Pos);
 
 #endif // #ifndef VAPOR__EVAL_H
@@ -11,6 +11,7 @@
 #include "notation.h"
 #include "zobrist.h"
 #include "moves.h"
+#include "eval.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -157,8 +158,14 @@ int importFEN(position *Pos, const char *FENStr)
   if (Pos->MoveNum < 1)
     Pos->MoveNum = 1;
 
-  /* calculate the zobrist key */
+  /* calculate the zobrist keys */
   Pos->ZKey = calcZobrist(Pos);
+  Pos->PawnKey = calcPawnZobrist(Pos);
+
+  /* calculate the material and piece-square scores and the game phase */
+  Pos->PcSqScore[MIDGAME] = calcPcSqScore(Pos, MIDGAME);
+  Pos->PcSqScore[ENDGAME] = calcPcSqScore(Pos, ENDGAME);
+  Pos->Phase = calcPhase(Pos);
 
   /* determine if active color is in check */
   if (attacked(Pos, firstSq(Pos->OccBy[Active][KING]), !Active))
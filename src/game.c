@@ -80,6 +80,7 @@ int setGamePos(const char *FENStr)
  */
 int makeGameMove(const char *MoveStr)
 {
+  checkinfo CI;
   move Move;
   int Result;
 
@@ -91,7 +92,8 @@ int makeGameMove(const char *MoveStr)
   }
 
   MoveList[nMoves] = coordToHashMove(MoveStr);
-  if (expandMove(&Pos, MoveList[nMoves++], &Move) != 0)
+  getCheckInfo(&Pos, &CI);
+  if (expandMove(&Pos, &CI, MoveList[nMoves++], &Move) != 0)
   {
     Pos.Flags |= PF_INVALID;
     return -1;
@@ -7,22 +7,112 @@
  * All rights reserved
  */
 
+// for mmap() and madvise() flags beyond POSIX
+#define _DEFAULT_SOURCE
+
 #include "hash.h"
 
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+
+#define CACHE_LINE_SIZE 64
+#define HUGE_PAGE_SIZE  0x200000 // 2MB
+#define MAX_CLEAR_THREADS 64
 
+/* hash files: a header, padded so the table can be mapped on a huge page */
+#define HASH_FILE_MAGIC   "VaporTT"
+#define HASH_FILE_FORMAT  1
+#define HASH_FILE_HEADER  HUGE_PAGE_SIZE
+#define SHARE_WAIT_MS     1000 // time to wait for another process to create
+typedef struct hash_file_header {
+  char Magic[8];        // HASH_FILE_MAGIC
+  uint32 Format;        // HASH_FILE_FORMAT
+  uint16 EntrySize;     // sizeof(hash_entry)
+  uint16 BucketSize;    // sizeof(hash_buckets)
+  uint32 nBuckets;      // NUM_BUCKETS
+  uint16 When;          // age of the newest entries
+  uint16 Unused;
+  uint64 nEntries;      // nHashEntries
+  uint32 nAttached;     // processes using a shared table
+} hash_file_header;
 
 hash_buckets *HashTable = NULL;
 uint64 IndexMask = 0;
 uint64 nHashEntries = 0;
+static int HashMapped = 0; // non-zero if HashTable came from mmap()
+static hash_file_header *SharedHeader = NULL; // header of a shared table
+static char SharedName[256];
+
+/******************************************************************************
+ * void *allocTable(uint64 Size);
+ * PARAMETERS
+ *    Size - Size in bytes of the table, a power of two.
+ * DESCRIPTION
+ *    Allocates memory for the hash table, without touching it, since
+ *    clearHash() has to write every entry anyway. Tables of a huge page or
+ *    more are mapped on a huge page boundary and the kernel is asked to back
+ *    them with huge pages, to cut down on TLB misses.
+ *    Otherwise, or if that fails, the table is just aligned to a cache line,
+ *    so that each bucket fills exactly one.
+ * RETURN VALUE
+ *    Returns a pointer to the memory, or NULL if it couldn't be allocated.
+ */
+static void *allocTable(uint64 Size)
+{
+  void *Mem;
+
+#if defined(MAP_ANONYMOUS) && defined(MADV_HUGEPAGE)
+  if (Size >= HUGE_PAGE_SIZE) {
+    // map an extra huge page, then trim to a huge page boundary
+    char *Map = mmap(NULL, Size + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (Map != MAP_FAILED) {
+      const uintptr_t Offset = -(uintptr_t)Map & (HUGE_PAGE_SIZE-1);
+
+      if (Offset) {
+        munmap(Map, Offset);
+      }
+      munmap(Map + Offset + Size, HUGE_PAGE_SIZE - Offset);
+      madvise(Map + Offset, Size, MADV_HUGEPAGE); // just a hint
+      HashMapped = 1;
+      return Map + Offset;
+    }
+  }
+#endif // #if defined(MAP_ANONYMOUS) && defined(MADV_HUGEPAGE)
+
+  if (posix_memalign(&Mem, CACHE_LINE_SIZE, Size) != 0) {
+    return NULL;
+  }
+  HashMapped = 0;
+  return Mem;
+}
+
+/* a slice of the hash table for one thread to clear */
+typedef struct clear_slice {
+  char *Start;
+  uint64 Size;
+} clear_slice;
+
+static void *clearSlice(void *Slice)
+{
+  memset(((clear_slice *)Slice)->Start, 0, ((clear_slice *)Slice)->Size);
+  return NULL;
+}
 
 
 /******************************************************************************
- * const void *initHash(uint64 Size);
+ * const void *initHash(uint64 Size, int nThreads);
  * PARAMETERS
  *    Size - Size in bytes of the HashTable.
+ *    nThreads - the number of threads to clear the table with.
  * DESCRIPTION
  *    Initial setup of the hash. HashTable must not have been previously setup
  *    and Size must be a power of two greater than or equal to
@@ -31,13 +121,13 @@ uint64 nHashEntries = 0;
  *    Returns a pointer to the hash table, or NULL if hash table creation
  *    failed, (including if the hash table already exists).
  */
-const void *initHash(uint64 Size)
+const void *initHash(uint64 Size, int nThreads)
 {
   uint64 nEntries = Size/sizeof(hash_buckets);
-  uint64 Mask = nEntries-1;
 
   // printf("sizeof(hash_entry) = %u\n", (unsigned)sizeof(hash_entry));
   assert(sizeof(hash_entry) == 16);
+  assert(sizeof(hash_buckets) == CACHE_LINE_SIZE);
 
   if (HashTable) {
     return NULL;
@@ -50,12 +140,402 @@ const void *initHash(uint64 Size)
     return NULL;
   }
 
-  HashTable = calloc(nEntries, sizeof(hash_buckets));
+  HashTable = allocTable(nEntries*sizeof(hash_buckets));
   if (HashTable) {
     nHashEntries = nEntries;
-    IndexMask = Mask;
-    memset(HashTable, 0, nEntries*sizeof(hash_buckets));
+    IndexMask = nEntries-1;
+    clearHash(nThreads);
+  }
+
+  return HashTable;
+}
+
+/******************************************************************************
+ * const void *resizeHash(uint64 Size, int nThreads);
+ * PARAMETERS
+ *    Size - New size in bytes of the HashTable, or 0 for no HashTable.
+ *    nThreads - the number of threads to clear the table with.
+ * DESCRIPTION
+ *    Frees the HashTable, if any, and sets up a new one of the given size.
+ * RETURN VALUE
+ *    Returns a pointer to the hash table, or NULL if there is none.
+ */
+const void *resizeHash(uint64 Size, int nThreads)
+{
+  freeHash();
+  return Size? initHash(Size, nThreads) : NULL;
+}
+
+/******************************************************************************
+ * void clearHash(int nThreads);
+ * PARAMETERS
+ *    nThreads - the number of threads to clear the table with.
+ * DESCRIPTION
+ *    Clears every entry of the HashTable. The table is split into slices of
+ *    whole huge pages, each cleared by its own short-lived thread, so that
+ *    clearing a large table doesn't take one core's memory bandwidth. The
+ *    threads aren't the search threads and aren't pinned, so this says
+ *    nothing about which NUMA node a page ends up on.
+ * RETURN VALUE
+ *    Does not return a value.
+ */
+void clearHash(int nThreads)
+{
+  const uint64 Size = nHashEntries*sizeof(hash_buckets);
+  clear_slice Slices[MAX_CLEAR_THREADS];
+  pthread_t Threads[MAX_CLEAR_THREADS];
+  int Started[MAX_CLEAR_THREADS];
+  uint64 SliceSize;
+  int i;
+
+  if (!HashTable) {
+    return;
+  }
+
+  // slices are whole huge pages, except when the table is smaller than one
+  nThreads = min(max(nThreads, 1), MAX_CLEAR_THREADS);
+  SliceSize = (Size/nThreads + HUGE_PAGE_SIZE-1) & ~(uint64)(HUGE_PAGE_SIZE-1);
+  if (SliceSize >= Size) {
+    SliceSize = Size;
+  }
+  nThreads = max((Size + SliceSize-1)/SliceSize, 1);
+
+  for (i = 0; i < nThreads; i++) {
+    Slices[i].Start = (char *)HashTable + i*SliceSize;
+    Slices[i].Size = (i == nThreads-1)? Size - i*SliceSize : SliceSize;
+  }
+  for (i = 1; i < nThreads; i++) {
+    Started[i] = pthread_create(&Threads[i], NULL, clearSlice, &Slices[i])
+        == 0;
+    if (!Started[i]) {
+      clearSlice(&Slices[i]);
+    }
+  }
+  clearSlice(&Slices[0]);
+  for (i = 1; i < nThreads; i++) {
+    if (Started[i]) {
+      pthread_join(Threads[i], NULL);
+    }
+  }
+}
+
+/******************************************************************************
+ * int checkHeader(const hash_file_header *Header, uint64 FileSize);
+ * PARAMETERS
+ *    Header - header of a saved or shared hash table.
+ *    FileSize - size in bytes of the file or shared memory holding it.
+ * DESCRIPTION
+ *    Checks that a table has the entry format this build uses, and that the
+ *    file is the right size to hold it.
+ * RETURN VALUE
+ *    Returns non-zero if the table can be used, or zero otherwise.
+ */
+static int checkHeader(const hash_file_header *Header, uint64 FileSize)
+{
+  return memcmp(Header->Magic, HASH_FILE_MAGIC, sizeof(Header->Magic)) == 0
+      && Header->Format == HASH_FILE_FORMAT
+      && Header->EntrySize == sizeof(hash_entry)
+      && Header->BucketSize == sizeof(hash_buckets)
+      && Header->nBuckets == NUM_BUCKETS
+      && Header->nEntries && !(Header->nEntries & (Header->nEntries-1))
+      && FileSize == HASH_FILE_HEADER + Header->nEntries*sizeof(hash_buckets);
+}
+
+/******************************************************************************
+ * int saveHash(const char *FileName, uint16 When);
+ * PARAMETERS
+ *    FileName - name of the file to save the HashTable to.
+ *    When - age of the newest entries, to be restored by loadHash().
+ * DESCRIPTION
+ *    Writes the HashTable to a file, after a header describing its size and
+ *    entry format.
+ * RETURN VALUE
+ *    Returns 0 upon success or 1 upon failure.
+ */
+int saveHash(const char *FileName, uint16 When)
+{
+  hash_file_header Header = {
+    HASH_FILE_MAGIC,        // magic
+    HASH_FILE_FORMAT,       // file format
+    sizeof(hash_entry),     // entry size
+    sizeof(hash_buckets),   // bucket size
+    NUM_BUCKETS,            // entries per bucket
+    When,                   // age of the newest entries
+    0,                      // unused
+    nHashEntries,           // number of buckets
+    0,                      // processes attached
+  };
+  FILE *File;
+  int Failed;
+
+  if (!HashTable || !(File = fopen(FileName, "wb"))) {
+    return 1;
+  }
+
+  Failed = fwrite(&Header, sizeof(Header), 1, File) != 1
+      || fseek(File, HASH_FILE_HEADER, SEEK_SET) != 0
+      || fwrite(HashTable, sizeof(hash_buckets), nHashEntries, File)
+          != nHashEntries;
+  Failed = (fclose(File) != 0) || Failed;
+
+  return Failed;
+}
+
+/******************************************************************************
+ * const void *loadHash(const char *FileName, uint16 *When);
+ * PARAMETERS
+ *    FileName - name of a file written by saveHash().
+ *    When - receives the age of the newest entries in the file.
+ * DESCRIPTION
+ *    Replaces the HashTable with the one saved in a file. The file is mapped
+ *    into memory privately, so its pages are read in as the search touches
+ *    them, and the search never writes back to it. The header must match
+ *    the entry format this build uses, and the size of the file, or the
+ *    current HashTable is left alone.
+ * RETURN VALUE
+ *    Returns a pointer to the hash table, or NULL if the file couldn't be
+ *    loaded.
+ */
+const void *loadHash(const char *FileName, uint16 *When)
+{
+  hash_file_header Header;
+  struct stat Stat;
+  void *Map;
+  int FD = open(FileName, O_RDONLY);
+
+  if (FD < 0) {
+    return NULL;
+  }
+
+  if (read(FD, &Header, sizeof(Header)) != sizeof(Header)
+      || fstat(FD, &Stat) != 0 || !checkHeader(&Header, Stat.st_size)) {
+    close(FD);
+    return NULL;
+  }
+
+  Map = mmap(NULL, Header.nEntries*sizeof(hash_buckets),
+      PROT_READ | PROT_WRITE, MAP_PRIVATE, FD, HASH_FILE_HEADER);
+  close(FD);
+  if (Map == MAP_FAILED) {
+    return NULL;
+  }
+#ifdef MADV_WILLNEED
+  madvise(Map, Header.nEntries*sizeof(hash_buckets), MADV_WILLNEED);
+#endif // #ifdef MADV_WILLNEED
+
+  freeHash();
+  HashTable = Map;
+  HashMapped = 1;
+  nHashEntries = Header.nEntries;
+  IndexMask = Header.nEntries-1;
+  *When = Header.When;
+
+  return HashTable;
+}
+
+/******************************************************************************
+ * int readSharedHeader(int FD, hash_file_header *Header, struct stat *Stat);
+ * PARAMETERS
+ *    FD - file descriptor of shared memory made by another process.
+ *    Header - receives the header of the shared table.
+ *    Stat - receives the status of the shared memory.
+ * DESCRIPTION
+ *    Reads the header of a shared table, waiting up to SHARE_WAIT_MS for the
+ *    process creating it to finish, which it shows by writing the magic.
+ * RETURN VALUE
+ *    Returns non-zero if the table can be used, or zero otherwise.
+ */
+static int readSharedHeader(int FD, hash_file_header *Header,
+    struct stat *Stat)
+{
+  const struct timespec Pause = {0, 10000000}; // 10ms
+  int Waited;
+
+  for (Waited = 0; ; Waited += 10) {
+    if (fstat(FD, Stat) == 0 && Stat->st_size >= HASH_FILE_HEADER
+        && pread(FD, Header, sizeof(*Header), 0) == sizeof(*Header)
+        && memcmp(Header->Magic, HASH_FILE_MAGIC, sizeof(Header->Magic))
+          == 0) {
+      return checkHeader(Header, Stat->st_size);
+    }
+    if (Waited >= SHARE_WAIT_MS) {
+      return 0;
+    }
+    nanosleep(&Pause, NULL);
   }
+}
+
+/******************************************************************************
+ * int joinShared(hash_file_header *Shared);
+ * PARAMETERS
+ *    Shared - header of a shared table made by another process.
+ * DESCRIPTION
+ *    Counts this process as attached to the shared table, unless the count
+ *    has already dropped to zero. Then the last process to detach is about
+ *    to remove the table's name (see freeHash()), and joining it would leave
+ *    this process on a table that the next one to share the name can't see.
+ * RETURN VALUE
+ *    Returns non-zero if this process is now attached, or zero if not.
+ */
+static int joinShared(hash_file_header *Shared)
+{
+  uint32 Count = __atomic_load_n(&Shared->nAttached, __ATOMIC_SEQ_CST);
+
+  do {
+    if (Count == 0) {
+      return 0;
+    }
+  } while (!__atomic_compare_exchange_n(&Shared->nAttached, &Count, Count+1,
+      0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+  return 1;
+}
+
+/******************************************************************************
+ * char *mapShared(const char *Name, hash_file_header *Header, int *Retry);
+ * PARAMETERS
+ *    Name - name of the POSIX shared memory object, starting with '/'.
+ *    Header - the header for a new table, which receives the header of the
+ *        table actually mapped.
+ *    Retry - set non-zero if the table under Name went away while trying.
+ * DESCRIPTION
+ *    Makes one attempt at creating the shared table, or at attaching to it
+ *    if it already exists, and counts this process as attached.
+ * RETURN VALUE
+ *    Returns the mapped shared memory, header first, or NULL on failure.
+ */
+static char *mapShared(const char *Name, hash_file_header *Header,
+    int *Retry)
+{
+  hash_file_header *Shared;
+  struct stat Stat;
+  char *Map;
+  int Created = 1;
+  int FD;
+
+  *Retry = 0;
+  FD = shm_open(Name, O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (FD < 0 && errno == EEXIST) {
+    Created = 0;
+    FD = shm_open(Name, O_RDWR, 0600);
+    *Retry = (FD < 0 && errno == ENOENT); // removed in the meantime
+  }
+  if (FD < 0) {
+    return NULL;
+  }
+
+  if (Created) {
+    while (Header->nEntries & (Header->nEntries-1)) {
+      Header->nEntries = Header->nEntries & (Header->nEntries-1);
+    }
+    // new shared memory reads as zeros, so the table starts out clear
+    if (!Header->nEntries || ftruncate(FD,
+        HASH_FILE_HEADER + Header->nEntries*sizeof(hash_buckets)) != 0) {
+      close(FD);
+      shm_unlink(Name);
+      return NULL;
+    }
+  } else if (!readSharedHeader(FD, Header, &Stat)) {
+    close(FD);
+    return NULL;
+  }
+
+  Map = mmap(NULL, HASH_FILE_HEADER + Header->nEntries*sizeof(hash_buckets),
+      PROT_READ | PROT_WRITE, MAP_SHARED, FD, 0);
+  close(FD);
+  if (Map == MAP_FAILED) {
+    if (Created) {
+      shm_unlink(Name);
+    }
+    return NULL;
+  }
+
+  Shared = (hash_file_header *)Map;
+  if (Created) {
+    // counted before the magic goes in, which it does last so that no one
+    // attaches to a half-made header
+    Header->nAttached = 1;
+    *Shared = *Header;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(Shared->Magic, HASH_FILE_MAGIC, sizeof(Header->Magic));
+  } else if (!joinShared(Shared)) {
+    munmap(Map, HASH_FILE_HEADER + Header->nEntries*sizeof(hash_buckets));
+    *Retry = 1;
+    return NULL;
+  }
+#ifdef MADV_HUGEPAGE
+  madvise(Map + HASH_FILE_HEADER, Header->nEntries*sizeof(hash_buckets),
+      MADV_HUGEPAGE); // just a hint
+#endif // #ifdef MADV_HUGEPAGE
+
+  return Map;
+}
+
+/******************************************************************************
+ * const void *shareHash(const char *Name, uint64 Size);
+ * PARAMETERS
+ *    Name - name of the POSIX shared memory object, starting with '/'.
+ *    Size - Size in bytes of the HashTable, if it has to be created.
+ * DESCRIPTION
+ *    Replaces the HashTable with one in shared memory, so that every process
+ *    on the machine using the same Name searches with the same table. The
+ *    first process creates the table, and the others attach to it with the
+ *    size it was created with, waiting briefly if it is still being created.
+ *    The shared memory has the same layout as a file from saveHash(), and
+ *    its header counts the processes attached, so that the last one to call
+ *    freeHash() removes it. A process finding a table that is being removed
+ *    waits for it to go and creates a new one. The old HashTable is only
+ *    freed once the shared one is ready. A process that dies without calling
+ *    freeHash() leaves the count too high (or, while creating the table,
+ *    leaves one no one can attach to), so the shared memory outlives the
+ *    engines using it. Once none are running, it can be removed by hand,
+ *    e.g. "rm /dev/shm/<name>" on Linux, and the next process starts afresh.
+ * RETURN VALUE
+ *    Returns a pointer to the hash table, or NULL if it couldn't be created
+ *    or attached to, in which case the old HashTable is kept.
+ */
+const void *shareHash(const char *Name, uint64 Size)
+{
+  const hash_file_header NewHeader = {
+    "",                     // magic, filled in once the table is ready
+    HASH_FILE_FORMAT,       // file format
+    sizeof(hash_entry),     // entry size
+    sizeof(hash_buckets),   // bucket size
+    NUM_BUCKETS,            // entries per bucket
+    0,                      // age of the newest entries
+    0,                      // unused
+    Size/sizeof(hash_buckets), // number of buckets
+    0,                      // processes attached
+  };
+  const struct timespec Pause = {0, 1000000}; // 1ms
+  hash_file_header Header;
+  char *Map;
+  int Retry;
+  int Waited;
+
+  if (strlen(Name) >= sizeof(SharedName)) {
+    return NULL;
+  }
+
+  for (Waited = 0; ; Waited++) {
+    Header = NewHeader;
+    Map = mapShared(Name, &Header, &Retry);
+    if (Map) {
+      break;
+    }
+    if (!Retry || Waited >= SHARE_WAIT_MS) {
+      return NULL;
+    }
+    nanosleep(&Pause, NULL);
+  }
+
+  // only now let go of the old table, which may be this same shared memory
+  freeHash();
+  SharedHeader = (hash_file_header *)Map;
+  strcpy(SharedName, Name);
+  HashTable = (hash_buckets *)(Map + HASH_FILE_HEADER);
+  HashMapped = 1;
+  nHashEntries = Header.nEntries;
+  IndexMask = Header.nEntries-1;
 
   return HashTable;
 }
@@ -63,14 +543,29 @@ const void *initHash(uint64 Size)
 /******************************************************************************
  * void freeHash(void);
  * DESCRIPTION
- *    Safely frees the memory allocated to the HashTable, if any.
+ *    Safely frees the memory allocated to the HashTable, if any, or detaches
+ *    from a shared HashTable.
  * RETURN VALUE
  *    Does not return a value.
  */
 void freeHash(void)
 {
   if (HashTable) {
-    free(HashTable);
+    if (SharedHeader) {
+      // detach, and remove the shared memory if nothing else is using it;
+      // joinShared() never raises a count of zero, so no one can be on it
+      if (__atomic_sub_fetch(&SharedHeader->nAttached, 1,
+          __ATOMIC_SEQ_CST) == 0) {
+        shm_unlink(SharedName);
+      }
+      munmap(SharedHeader,
+          HASH_FILE_HEADER + nHashEntries*sizeof(hash_buckets));
+      SharedHeader = NULL;
+    } else if (HashMapped) {
+      munmap(HashTable, nHashEntries*sizeof(hash_buckets));
+    } else {
+      free(HashTable);
+    }
     HashTable = NULL;
     nHashEntries = 0;
     IndexMask = 0;
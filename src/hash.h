@@ -14,6 +14,7 @@
 #include "chess.h"
 
 #include <stdlib.h>
+#include <string.h>
 
 typedef enum hash_bound {
   upperbound,
@@ -29,17 +30,32 @@ typedef struct hash_entry {
   int16 Score;      // 2 bytes
   hashmove Move;    // 2 bytes
 } hash_entry;       // 16 bytes
+// NOTE: in HashTable, ZKey is stored xor-ed with the other 8 bytes (the data
+//       word), so that an entry torn by threads writing to it at the same
+//       time no longer matches its key, and no locks are needed
+#ifdef COMPACT_HASH
+// each position stored in the table keeps only a 16 bit check of its key;
+// the bits used to index the table don't need to be stored at all
+#define NUM_BUCKETS 6
+typedef struct hash_buckets {
+  uint16 Check[NUM_BUCKETS];  // 12 bytes
+  uint16 Unused[2];           // 4 bytes
+  uint64 Data[NUM_BUCKETS];   // 48 bytes
+} hash_buckets;               // 64 bytes
+#else
 #define NUM_BUCKETS 4
 typedef hash_entry hash_buckets[NUM_BUCKETS];
+#endif // #ifdef COMPACT_HASH
 extern hash_buckets *HashTable;
 extern uint64 IndexMask;
 extern uint64 nHashEntries;
 
 
 /******************************************************************************
- * const void *initHash(uint64 Size);
+ * const void *initHash(uint64 Size, int nThreads);
  * PARAMETERS
  *    Size - Size in bytes of the HashTable.
+ *    nThreads - the number of threads to clear the table with.
  * DESCRIPTION
  *    Initial setup of the hash. HashTable must not have been previously setup
  *    and Size must be a power of two greater than or equal to
@@ -48,81 +64,257 @@ extern uint64 nHashEntries;
  *    Returns a pointer to the hash table, or NULL if hash table creation
  *    failed, (including if the hash table already exists).
  */
-const void *initHash(uint64 Size);
+const void *initHash(uint64 Size, int nThreads);
+
+/******************************************************************************
+ * const void *resizeHash(uint64 Size, int nThreads);
+ * PARAMETERS
+ *    Size - New size in bytes of the HashTable, or 0 for no HashTable.
+ *    nThreads - the number of threads to clear the table with.
+ * DESCRIPTION
+ *    Frees the HashTable, if any, and sets up a new one of the given size.
+ * RETURN VALUE
+ *    Returns a pointer to the hash table, or NULL if there is none.
+ */
+const void *resizeHash(uint64 Size, int nThreads);
+
+/******************************************************************************
+ * void clearHash(int nThreads);
+ * PARAMETERS
+ *    nThreads - the number of threads to clear the table with.
+ * DESCRIPTION
+ *    Clears every entry of the HashTable, splitting the work between nThreads
+ *    threads to make clearing a large table faster.
+ * RETURN VALUE
+ *    Does not return a value.
+ */
+void clearHash(int nThreads);
+
+/******************************************************************************
+ * int saveHash(const char *FileName, uint16 When);
+ * PARAMETERS
+ *    FileName - name of the file to save the HashTable to.
+ *    When - age of the newest entries, to be restored by loadHash().
+ * DESCRIPTION
+ *    Writes the HashTable to a file, after a header describing its size and
+ *    entry format.
+ * RETURN VALUE
+ *    Returns 0 upon success or 1 upon failure.
+ */
+int saveHash(const char *FileName, uint16 When);
+
+/******************************************************************************
+ * const void *loadHash(const char *FileName, uint16 *When);
+ * PARAMETERS
+ *    FileName - name of a file written by saveHash().
+ *    When - receives the age of the newest entries in the file.
+ * DESCRIPTION
+ *    Replaces the HashTable with the one saved in a file, mapping the file
+ *    into memory. The file must have the same entry format as this build.
+ * RETURN VALUE
+ *    Returns a pointer to the hash table, or NULL if the file couldn't be
+ *    loaded, in which case the old HashTable is kept.
+ */
+const void *loadHash(const char *FileName, uint16 *When);
+
+/******************************************************************************
+ * const void *shareHash(const char *Name, uint64 Size);
+ * PARAMETERS
+ *    Name - name of the POSIX shared memory object, starting with '/'.
+ *    Size - Size in bytes of the HashTable, if it has to be created.
+ * DESCRIPTION
+ *    Replaces the HashTable with one in shared memory, which every process
+ *    using the same Name searches with. The first process creates it, and
+ *    the others attach to it with the size it was created with. Shared
+ *    memory left behind by a process that crashed can be removed by hand,
+ *    e.g. "rm /dev/shm/<name>" on Linux.
+ * RETURN VALUE
+ *    Returns a pointer to the hash table, or NULL if it couldn't be created
+ *    or attached to, in which case the old HashTable is kept.
+ */
+const void *shareHash(const char *Name, uint64 Size);
 
 /******************************************************************************
  * void freeHash(void);
  * DESCRIPTION
- *    Safely frees the memory allocated to the HashTable.
+ *    Safely frees the memory allocated to the HashTable, or detaches from a
+ *    shared HashTable, removing it if no other process is using it.
  * RETURN VALUE
  *    Does not return a value.
  */
 void freeHash(void);
 
 /******************************************************************************
- * static inline const hash_entry *hashLookup(zobrist ZKey);
+ * static inline uint64 hashData(const hash_entry *Entry);
+ * PARAMETERS
+ *    Entry - the hash entry.
+ * DESCRIPTION
+ *    Gets the data word of a hash entry: the 8 bytes following ZKey.
+ * RETURN VALUE
+ *    Returns the data word.
+ */
+static inline uint64 hashData(const hash_entry *Entry)
+{
+  uint64 Data;
+
+  memcpy(&Data, (const char *)Entry + sizeof(zobrist), sizeof(Data));
+  return Data;
+}
+
+#ifdef COMPACT_HASH
+/******************************************************************************
+ * static inline uint16 hashCheck(zobrist ZKey, uint64 Data);
+ * PARAMETERS
+ *    ZKey - Zobrist key of the position.
+ *    Data - the data word stored for the position.
+ * DESCRIPTION
+ *    Computes the check stored alongside Data in a compact HashTable: the top
+ *    16 bits of ZKey, xor-ed with each 16 bits of Data, so that a check and
+ *    data word written by different threads are unlikely to match.
+ * RETURN VALUE
+ *    Returns the check.
+ */
+static inline uint16 hashCheck(zobrist ZKey, uint64 Data)
+{
+  return (uint16)((ZKey >> 48) ^ (Data >> 48) ^ (Data >> 32) ^ (Data >> 16)
+      ^ Data);
+}
+#endif // #ifdef COMPACT_HASH
+
+/******************************************************************************
+ * static inline void prefetchHash(zobrist ZKey);
+ * PARAMETERS
+ *    ZKey - Zobrist key of a position that is about to be looked up.
+ * DESCRIPTION
+ *    Starts loading the bucket for ZKey into the cache, so that the lookup
+ *    doesn't have to wait on main memory.
+ * RETURN VALUE
+ *    Does not return a value.
+ */
+static inline void prefetchHash(zobrist ZKey)
+{
+#ifdef __GNUC__
+  if (HashTable) {
+    __builtin_prefetch(&HashTable[ZKey & IndexMask]);
+  }
+#endif // #ifdef __GNUC__
+}
+
+/******************************************************************************
+ * static inline int hashLookup(zobrist ZKey, hash_entry *Entry);
  * PARAMETERS
  *    ZKey - Zobrist key used to fine hash score.
+ *    Entry - receives a copy of the hash entry, if found.
  * DESCRIPTION
- *    Find the hash entry with the given Zobrist key, if any.
+ *    Find the hash entry with the given Zobrist key, if any. The entry is
+ *    copied before it is checked, so that it can't change after the check
+ *    even if another thread overwrites it.
  * RETURN VALUE
- *    Returns a pointer to the hash entry, or NULL if no such entry exists.
+ *    Returns non-zero if the entry was found, or zero otherwise.
  */
-static inline const hash_entry *hashLookup(zobrist ZKey)
+static inline int hashLookup(zobrist ZKey, hash_entry *Entry)
 {
   const uint64 Index = (uint64) (ZKey & IndexMask);
   int Bucket;
 
   if (!HashTable) {
-    return NULL;
+    return 0;
   }
 
+#ifdef COMPACT_HASH
   for (Bucket = 0; Bucket < NUM_BUCKETS; Bucket++) {
-    if (HashTable[Index][Bucket].ZKey == ZKey && HashTable[Index][Bucket].When) {
-      return &HashTable[Index][Bucket];
+    const uint64 Data = HashTable[Index].Data[Bucket];
+
+    if (HashTable[Index].Check[Bucket] == hashCheck(ZKey, Data)) {
+      Entry->ZKey = ZKey;
+      memcpy((char *)Entry + sizeof(zobrist), &Data, sizeof(Data));
+      if (Entry->When) {
+        return 1;
+      }
     }
   }
+#else
+  for (Bucket = 0; Bucket < NUM_BUCKETS; Bucket++) {
+    *Entry = HashTable[Index][Bucket];
+    Entry->ZKey ^= hashData(Entry);
+    if (Entry->ZKey == ZKey && Entry->When) {
+      return 1;
+    }
+  }
+#endif // #ifdef COMPACT_HASH
 
   // not found
-  return NULL;
+  return 0;
 }
 
 /******************************************************************************
- * static inline const hash_entry *saveToHash(const hash_entry *HashEntry);
+ * static inline void saveToHash(const hash_entry *HashEntry);
  * PARAMETERS
  *    HashEntry - The hash entry to store.
  * DESCRIPTION
  *    Stores and entry in the transposition table (hash).
  * RETURN VALUE
- *    Returns pointer to the saved entry in the hash. Returns NULL if the store
- *    failed.
+ *    Does not return a value.
  */
-static inline const hash_entry *saveToHash(const hash_entry *HashEntry)
+static inline void saveToHash(const hash_entry *HashEntry)
 {
-  const uint64 Index = (uint64) (HashEntry->ZKey & IndexMask);
+#ifdef COMPACT_HASH
+  hash_buckets *Entries;
+  hash_entry Entry;
+  uint64 Data;
+#else
+  hash_entry *Entries;
+  hash_entry NewEntry;
+#endif // #ifdef COMPACT_HASH
   int CurDraft;
   int Draft;
   int Bucket = 0;
 
   if (!HashTable || !HashEntry) {
-    return NULL;
+    return;
+  }
+
+#ifdef COMPACT_HASH
+  Entries = &HashTable[HashEntry->ZKey & IndexMask];
+  Entry.ZKey = 0;
+  memcpy((char *)&Entry + sizeof(zobrist), &Entries->Data[0], sizeof(Data));
+  Draft = Entry.Depth + Entry.When;
+  for (int i = 1; i < NUM_BUCKETS; i++) {
+    Data = Entries->Data[i];
+    if (Entries->Check[i] == hashCheck(HashEntry->ZKey, Data)) {
+      Bucket = i;
+      break;
+    }
+    memcpy((char *)&Entry + sizeof(zobrist), &Data, sizeof(Data));
+    CurDraft = (Entry.Depth + Entry.When);
+    if (CurDraft > Draft) {
+      Draft = CurDraft;
+      Bucket = i;
+    }
   }
 
-  Draft = HashTable[Index][0].Depth + HashTable[Index][0].When;
+  Data = hashData(HashEntry);
+  Entries->Data[Bucket] = Data;
+  Entries->Check[Bucket] = hashCheck(HashEntry->ZKey, Data);
+#else
+  Entries = HashTable[HashEntry->ZKey & IndexMask];
+  Draft = Entries[0].Depth + Entries[0].When;
   for (int i = 1; i < NUM_BUCKETS; i++) {
-    if (HashTable[Index][i].ZKey == HashEntry->ZKey) {
+    if ((Entries[i].ZKey ^ hashData(&Entries[i])) == HashEntry->ZKey) {
       Bucket = i;
       break;
     }
-    CurDraft = (HashTable[Index][i].Depth + HashTable[Index][i].When);
+    CurDraft = (Entries[i].Depth + Entries[i].When);
     if (CurDraft > Draft) {
       Draft = CurDraft;
       Bucket = i;
     }
   }
 
-  HashTable[Index][Bucket] = *HashEntry;
-  return &HashTable[Index][Bucket];
+  NewEntry = *HashEntry;
+  NewEntry.ZKey ^= hashData(&NewEntry);
+  Entries[Bucket] = NewEntry;
+#endif // #ifdef COMPACT_HASH
 }
 
 #endif // #ifndef VAPOR__HASH_H
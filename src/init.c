@@ -10,13 +10,22 @@
 #include "init.h"
 #include "moves.h"
 #include "game.h"
+#include "eval.h"
 
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
+#ifdef __x86_64__
+#include <cpuid.h>
+#endif // #ifdef __x86_64__
+
+/* processor features */
+int HasPopcnt = 0;
+
 /* diagonal and antidiagonal masks */
-const bitboard DIAGMASK[NUM_SQUARES];     // a1 to h8 direction
-const bitboard ANTIDIAGMASK[NUM_SQUARES]; // a8 to h1 direction
+bitboard DIAGMASK[NUM_SQUARES];     // a1 to h8 direction
+bitboard ANTIDIAGMASK[NUM_SQUARES]; // a8 to h1 direction
 
 static void initMasks(void)
 {
@@ -161,11 +170,249 @@ static void initFileAttacks(void)
   }
 }
 
+/* magic multipliers, found by a random search over sparse 64-bit numbers */
+static const bitboard BISHOP_MAGICS[NUM_SQUARES] = {
+  0x10102002004a1420, 0x8020040400584008, 0x10510800811201c8,
+  0x5204042080000088, 0x2204106880000002, 0x1401042004000000,
+  0x0400880410042004, 0x0028208200a02020, 0x1500241990010e00,
+  0x8001200182020a40, 0x40004101030b0000, 0x8002041042000100,
+  0x4010011041020038, 0x0000010421044000, 0x1500210808020a00,
+  0x8000088400880520, 0x0405004010040100, 0x1005823210040108,
+  0x2708008102040011, 0x4048200404009100, 0x0018104101400024,
+  0x0003000601190101, 0x8004803108491000, 0x8014241200820800,
+  0x0006e080100c3040, 0x0501044a11041800, 0x9020300008004045,
+  0x0894080000220040, 0x1001010083104000, 0x5004030040900080,
+  0x000400422c012400, 0x0002128698404812, 0x1010108404900440,
+  0x0928021182084100, 0x2006080409020024, 0x1010202020180080,
+  0xa010008200202200, 0x2098015100019004, 0x0002041440810811,
+  0x802a02020000b098, 0x0009015090004060, 0x4000821082081001,
+  0x0100210040420800, 0x0800004010488a00, 0x2000081104004040,
+  0x4c8e029015000082, 0x0420340322224842, 0x1298260043400210,
+  0x0000822802400008, 0x00008a0101600000, 0x3040003412080021,
+  0x3040290220884800, 0x4a1500401041004a, 0x8010200282020781,
+  0x0020203142209091, 0x0070300600902110, 0x0040808800b62048,
+  0x0000810400c44420, 0x00080400440c0441, 0x8340080020840411,
+  0x0000000104208200, 0x0000800810d00080, 0x0400530411080200,
+  0x4040702400932244,
+};
+static const bitboard ROOK_MAGICS[NUM_SQUARES] = {
+  0x1080004008801020, 0x0840092002c03000, 0x1900200010400900,
+  0x0880100008000480, 0x4200100420080200, 0x8100020100080400,
+  0x0200040110886200, 0x0200008040220411, 0x0404800084400220,
+  0x0000401000402000, 0x0086001081220440, 0x0408800800100280,
+  0x000a001201040820, 0x8848800200840080, 0x4001000100040200,
+  0x0442000102105084, 0x9080010020804100, 0x0040404000201009,
+  0x0000808010002009, 0x2200090021d00100, 0x0008008008040080,
+  0x0004004002010040, 0x0011040008015042, 0x00000a0001768104,
+  0x0000800080204009, 0x2010004140002001, 0x9800200280100080,
+  0x1000100080080080, 0x0442000a00049020, 0x2100040080020080,
+  0x0800120400900148, 0x0010040a00128541, 0x2800804000800030,
+  0x1010002000400041, 0x4000200011004100, 0x0610008410800800,
+  0x0400802402800800, 0xc100020080800400, 0x0002000802000401,
+  0x0182085882000401, 0x0220204000808000, 0x2860100040024022,
+  0x0001002004110040, 0x99101042000a0020, 0x0004080004008080,
+  0x0010040002008080, 0x2012004881020004, 0x8300842444820011,
+  0x0088403882010200, 0x0820400080210100, 0x0110910040a00300,
+  0x0801100280080480, 0x0242009008200600, 0x1002000489500200,
+  0x0040800200010080, 0x0091800041000080, 0x0000209300488001,
+  0x04c1002414824001, 0x020020000b001041, 0x7000100004200901,
+  0x8002002004100802, 0x30010002084c0007, 0x0888221800813004,
+  0x4000002840840112,
+};
+
+static bitboard lineBishopAtt(bitboard Occ, square Sq)
+{
+  return diagonalAtt(Occ, Sq) | antidiagAtt(Occ, Sq);
+}
+
+static bitboard lineRookAtt(bitboard Occ, square Sq)
+{
+  return rankAtt(Occ, Sq) | fileAtt(Occ, Sq);
+}
+
+static bitboard bishopMask(square Sq)
+{
+  const bitboard Edges = FILEMASK(F_a) | FILEMASK(F_h)
+      | RANKMASK(R_1) | RANKMASK(R_8);
+
+  return lineBishopAtt(0, Sq) & ~Edges;
+}
+
+static bitboard rookMask(square Sq)
+{
+  return (rankAtt(0, Sq) & ~(FILEMASK(F_a) | FILEMASK(F_h)))
+      | (fileAtt(0, Sq) & ~(RANKMASK(R_1) | RANKMASK(R_8)));
+}
+
+static void initMagics(magic *Magics, bitboard *AttTable,
+    const bitboard *Multipliers, bitboard (*lineAtt)(bitboard, square),
+    bitboard (*mask)(square))
+{
+  bitboard *Att = AttTable;
+  bitboard Bd;
+  int Size;
+  square sq;
+
+  for (sq = a1; sq < NUM_SQUARES; sq++)
+  {
+    magic *const M = &Magics[sq];
+
+    M->Mask = mask(sq);
+    M->Magic = Multipliers[sq];
+    M->Shift = 64 - popCnt(M->Mask);
+    M->Att = Att;
+
+    // fill in the attacks for every subset of the mask (carry-rippler)
+    Size = 0;
+    Bd = 0;
+    do {
+      assert(Att[sliderIndex(M, Bd)] == 0
+          || Att[sliderIndex(M, Bd)] == lineAtt(Bd, sq));
+      Att[sliderIndex(M, Bd)] = lineAtt(Bd, sq);
+      Size++;
+      Bd = (Bd - M->Mask) & M->Mask;
+    } while (Bd);
+
+    Att += Size;
+  }
+}
+
+/******************************************************************************
+ * int hasBMI2(void);
+ * DESCRIPTION
+ *    Determines whether the processor supports the BMI2 instruction set.
+ * RETURN VALUE
+ *    Returns 1 if BMI2 is supported, or 0 if it is not.
+ * PORTABILITY ISSUES
+ *    Contains gcc-specific code. Always returns 0 on non-AMD64 machines.
+ */
+int hasBMI2(void)
+{
+#ifdef __x86_64__
+  unsigned int Eax, Ebx, Ecx, Edx;
+
+  if (__get_cpuid_count(7, 0, &Eax, &Ebx, &Ecx, &Edx))
+    return (Ebx & bit_BMI2) != 0;
+#endif // #ifdef __x86_64__
+  return 0;
+}
+
+/******************************************************************************
+ * int hasFastPext(void);
+ * DESCRIPTION
+ *    Determines whether the processor has a pext instruction that is faster
+ *    than a magic multiplication. AMD processors before Zen 3 (family 0x19)
+ *    support BMI2, but run pext in microcode, taking dozens of cycles.
+ * RETURN VALUE
+ *    Returns 1 if pext is supported and fast, or 0 otherwise.
+ * PORTABILITY ISSUES
+ *    Contains gcc-specific code. Always returns 0 on non-AMD64 machines.
+ */
+static int hasFastPext(void)
+{
+#ifdef __x86_64__
+  unsigned int Eax, Ebx, Ecx, Edx;
+  unsigned int Family;
+
+  if (!hasBMI2() || !__get_cpuid(0, &Eax, &Ebx, &Ecx, &Edx))
+    return 0;
+  if (Ebx != signature_AMD_ebx || Edx != signature_AMD_edx
+      || Ecx != signature_AMD_ecx)
+    return 1;
+
+  if (!__get_cpuid(1, &Eax, &Ebx, &Ecx, &Edx))
+    return 0;
+  Family = (Eax >> 8) & 0xf;
+  if (Family == 0xf)
+    Family += (Eax >> 20) & 0xff;
+  return Family >= 0x19;
+#else // __x86_64__ not defined
+  return 0;
+#endif // #ifdef __x86_64__
+}
+
+/******************************************************************************
+ * int setSliderBackend(sliderbackend Backend);
+ * PARAMETERS
+ *    Backend - the method to use for indexing the slider attack tables.
+ * DESCRIPTION
+ *    Rebuilds the bishop and rook attack tables for Backend and makes it the
+ *    backend used by bishopAtt() and rookAtt().
+ * RETURN VALUE
+ *    Returns 0 on success, or -1 if Backend is not supported by this
+ *    processor, in which case the tables are unchanged.
+ */
+int setSliderBackend(sliderbackend Backend)
+{
+  if (Backend == SB_PEXT && !hasBMI2())
+    return -1;
+
+  SliderBackend = Backend;
+  memset(BISHOP_ATT, 0, sizeof(BISHOP_ATT));
+  memset(ROOK_ATT, 0, sizeof(ROOK_ATT));
+  initMagics(BISHOP_MAGIC, BISHOP_ATT, BISHOP_MAGICS, lineBishopAtt,
+      bishopMask);
+  initMagics(ROOK_MAGIC, ROOK_ATT, ROOK_MAGICS, lineRookAtt, rookMask);
+
+  return 0;
+}
+
+static void initCPUFeatures(void)
+{
+#ifdef __x86_64__
+  unsigned int Eax, Ebx, Ecx, Edx;
+
+  if (__get_cpuid(1, &Eax, &Ebx, &Ecx, &Edx))
+    HasPopcnt = (Ecx & bit_POPCNT) != 0;
+#endif // #ifdef __x86_64__
+}
+
+static void initSliderAttacks(void)
+{
+  // use pext when the processor has a fast one, otherwise magic
+  // multiplication
+  if (!hasFastPext() || setSliderBackend(SB_PEXT) != 0)
+    setSliderBackend(SB_MAGIC);
+}
+
+static void initLines(void)
+{
+  bitboard (*const Between)[NUM_SQUARES] = BETWEEN;
+  bitboard (*const Line)[NUM_SQUARES] = LINE;
+  square s1, s2;
+
+  for (s1 = a1; s1 < NUM_SQUARES; s1++)
+  {
+    for (s2 = a1; s2 < NUM_SQUARES; s2++)
+    {
+      Between[s1][s2] = Line[s1][s2] = 0;
+      if (s1 == s2)
+        continue;
+
+      if (rookAtt(0, s1) & SQMASK(s2))
+      {
+        Between[s1][s2] = rookAtt(SQMASK(s2), s1) & rookAtt(SQMASK(s1), s2);
+        Line[s1][s2] = (rookAtt(0, s1) & rookAtt(0, s2))
+            | SQMASK(s1) | SQMASK(s2);
+      }
+      else if (bishopAtt(0, s1) & SQMASK(s2))
+      {
+        Between[s1][s2] = bishopAtt(SQMASK(s2), s1)
+            & bishopAtt(SQMASK(s1), s2);
+        Line[s1][s2] = (bishopAtt(0, s1) & bishopAtt(0, s2))
+            | SQMASK(s1) | SQMASK(s2);
+      }
+    }
+  }
+}
+
 static void initAttackTables(void)
 {
   initKnightAttacks();
   initKingAttacks();
   initFileAttacks();
+  initSliderAttacks();
+  initLines();
 }
 
 void init(void)
@@ -175,8 +422,10 @@ void init(void)
   if (Initialized)
     return;
 
+  initCPUFeatures();
   initMasks();
   initAttackTables();
+  initEval();
 
   resetGame();
 
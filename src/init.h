@@ -11,9 +11,32 @@
 #define VAPOR__INIT_H
 
 #include "vapor.h"
+#include "moves.h"
 
 void init(void);
 
+/******************************************************************************
+ * int hasBMI2(void);
+ * DESCRIPTION
+ *    Determines whether the processor supports the BMI2 instruction set.
+ * RETURN VALUE
+ *    Returns 1 if BMI2 is supported, or 0 if it is not.
+ */
+int hasBMI2(void);
+
+/******************************************************************************
+ * int setSliderBackend(sliderbackend Backend);
+ * PARAMETERS
+ *    Backend - the method to use for indexing the slider attack tables.
+ * DESCRIPTION
+ *    Rebuilds the bishop and rook attack tables for Backend and makes it the
+ *    backend used by bishopAtt() and rookAtt().
+ * RETURN VALUE
+ *    Returns 0 on success, or -1 if Backend is not supported by this
+ *    processor, in which case the tables are unchanged.
+ */
+int setSliderBackend(sliderbackend Backend);
+
 #endif // #ifndef VAPOR__INIT_H
 
 /* end of file */
@@ -13,12 +13,124 @@
 #include "notation.h"
 #include "fen.h"
 #include "microtime.h"
+#include "init.h"
 
 #include <stdio.h>
 #include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
 
-static uint64 Nodes;
-static char FENStr[128];
+static THREAD_LOCAL uint64 Nodes;
+static THREAD_LOCAL char FENStr[128];
+
+/* perft hash: caches subtree counts by position and remaining depth */
+typedef struct perft_entry {
+  zobrist ZKey;     // 8 bytes
+  uint64 Data;      // 8 bytes: count in the high 56 bits, depth in the low 8
+} perft_entry;      // 16 bytes
+// NOTE: ZKey is stored xor-ed with Data, so that an entry torn by another
+//       thread writing to it at the same time simply fails to match
+#define PERFT_BUCKETS 2 // [0] is depth-preferred, [1] is always-replace
+typedef perft_entry perft_buckets[PERFT_BUCKETS];
+static perft_buckets *PerftTable = NULL;
+static uint64 PerftMask = 0;
+static const uint64 MEGABYTE = 0x100000;
+
+/******************************************************************************
+ * const void *initPerftHash(uint64 Size);
+ * PARAMETERS
+ *    Size - Size in bytes of the perft hash, or 0 for no perft hash.
+ * DESCRIPTION
+ *    Allocates the perft hash, rounding Size down to a power of two buckets.
+ * RETURN VALUE
+ *    Returns a pointer to the perft hash, or NULL if it wasn't created.
+ */
+static const void *initPerftHash(uint64 Size)
+{
+  uint64 nEntries = Size/sizeof(perft_buckets);
+
+  while (nEntries & (nEntries-1)) {
+    nEntries = nEntries & (nEntries-1);
+  }
+  if (PerftTable || !nEntries) {
+    return NULL;
+  }
+
+  PerftTable = calloc(nEntries, sizeof(perft_buckets));
+  if (PerftTable) {
+    PerftMask = nEntries-1;
+  }
+
+  return PerftTable;
+}
+
+/******************************************************************************
+ * void freePerftHash(void);
+ * DESCRIPTION
+ *    Safely frees the memory allocated to the perft hash, if any.
+ * RETURN VALUE
+ *    Does not return a value.
+ */
+static void freePerftHash(void)
+{
+  if (PerftTable) {
+    free(PerftTable);
+    PerftTable = NULL;
+    PerftMask = 0;
+  }
+}
+
+/******************************************************************************
+ * int perftLookup(zobrist ZKey, int Depth, uint64 *Count);
+ * PARAMETERS
+ *    ZKey - Zobrist key of the position.
+ *    Depth - the remaining depth of the subtree.
+ *    Count - receives the cached number of variations, if found.
+ * DESCRIPTION
+ *    Looks up the number of variations of the given depth from the position
+ *    with the given Zobrist key.
+ * RETURN VALUE
+ *    Returns non-zero if the count was found.
+ */
+static inline int perftLookup(zobrist ZKey, int Depth, uint64 *Count)
+{
+  perft_entry *const Bucket = PerftTable[ZKey & PerftMask];
+  uint64 Data;
+  int i;
+
+  for (i = 0; i < PERFT_BUCKETS; i++) {
+    Data = Bucket[i].Data;
+    if ((Bucket[i].ZKey ^ Data) == ZKey && (int)(Data & 0xff) == Depth) {
+      *Count = Data >> 8;
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+/******************************************************************************
+ * void perftStore(zobrist ZKey, int Depth, uint64 Count);
+ * PARAMETERS
+ *    ZKey - Zobrist key of the position.
+ *    Depth - the remaining depth of the subtree.
+ *    Count - the number of variations in the subtree.
+ * DESCRIPTION
+ *    Stores a subtree count in the perft hash. Deeper subtrees are worth more,
+ *    so they go in the depth-preferred entry when they are at least as deep as
+ *    the one already there. Anything else goes in the always-replace entry.
+ * RETURN VALUE
+ *    Does not return a value.
+ */
+static inline void perftStore(zobrist ZKey, int Depth, uint64 Count)
+{
+  perft_entry *const Bucket = PerftTable[ZKey & PerftMask];
+  const int i = (Depth >= (int)(Bucket[0].Data & 0xff))? 0 : 1;
+  const uint64 Data = (Count << 8) | (uint64)Depth;
+
+  Bucket[i].ZKey = ZKey ^ Data;
+  Bucket[i].Data = Data;
+}
 
 static int isConsistent(const position *Pos)
 {
@@ -50,9 +162,23 @@ static int isConsistent(const position *Pos)
   return isPosLegal(Pos);
 }
 
+static int isSamePosition(const position *Pos1, const position *Pos2)
+{
+  return Pos1->ZKey == Pos2->ZKey && Pos1->PawnKey == Pos2->PawnKey
+      && Pos1->Occ == Pos2->Occ
+      && memcmp(Pos1->OccBy, Pos2->OccBy, sizeof(Pos1->OccBy)) == 0
+      && Pos1->EPSquare == Pos2->EPSquare && Pos1->Flags == Pos2->Flags
+      && Pos1->DrawPlies == Pos2->DrawPlies
+      && Pos1->MoveNum == Pos2->MoveNum
+      && Pos1->PcSqScore[MIDGAME] == Pos2->PcSqScore[MIDGAME]
+      && Pos1->PcSqScore[ENDGAME] == Pos2->PcSqScore[ENDGAME]
+      && Pos1->Phase == Pos2->Phase;
+}
+
 static uint64 countVariations(const position *Pos, int Depth)
 {
   position NewPos;
+  checkinfo CI;
   int MvBase;
   int nMoves;
   uint64 Total = 0;
@@ -63,9 +189,29 @@ static uint64 countVariations(const position *Pos, int Depth)
   if (Depth == 0)
     return 1;
 
+  if (PerftTable && Depth > 1 && perftLookup(Pos->ZKey, Depth, &Total))
+    return Total;
+
+  // since the generators produce only legal moves, the moves of the last ply
+  // can be counted without making them (but they still count as nodes)
+  if (Depth == 1)
+  {
+    nMoves = countMoves(Pos);
+    Nodes += nMoves;
+    return nMoves;
+  }
+
   MvBase = getMoveStackTop();
-  nMoves = genCaptures(Pos) + genQuietMoves(Pos);
+  if (Pos->Flags & PF_CHECK)
+    nMoves = genCheckEvasions(Pos);
+  else
+  {
+    getCheckInfo(Pos, &CI);
+    nMoves = genCaptures(Pos, &CI) + genQuietMoves(Pos, &CI);
+  }
 
+  // copying the position is cheaper here than unmaking the move, since
+  // nothing else is done between the moves (mgtestCount() tests unmaking)
   for (i = 0; i < nMoves; i++)
   {
     NewPos = *Pos;
@@ -75,13 +221,269 @@ static uint64 countVariations(const position *Pos, int Depth)
 
   popMoveStack(MvBase);
 
+  if (PerftTable)
+    perftStore(Pos->ZKey, Depth, Total);
+
   return Total;
 }
 
-static int64 mgtestCount(const position *Pos, int Depth)
+/* root moves and jobs for counting variations on several threads */
+typedef struct perft_root {
+  move Move;
+  uint64 Count;     // variations found so far below this move
+  uint64 Nodes;     // nodes visited so far below this move
+  microtime Time;   // time spent so far below this move, summed over threads
+  int Pending;      // number of jobs for this move that haven't finished
+} perft_root;
+
+typedef struct perft_job {
+  position Pos;     // position to count variations from
+  int Root;         // index of the root move the position descends from
+} perft_job;
+
+typedef struct perft_pool {
+  perft_root *Roots;
+  int nRoots;
+  int nPrinted;     // number of root moves printed so far
+  perft_job *Jobs;
+  int nJobs;
+  int NextJob;      // index of the next job to hand out
+  int Depth;        // depth to count to from each job's position
+  int Verbose;      // non-zero to print each root move as it completes
+  pthread_mutex_t Lock;
+} perft_pool;
+
+/******************************************************************************
+ * void printRoots(perft_pool *Pool);
+ * PARAMETERS
+ *    Pool - the pool being worked on.
+ * DESCRIPTION
+ *    Prints the counts of any completed root moves, keeping them in the order
+ *    they were generated, so that the output doesn't depend on the number of
+ *    threads. Pool->Lock must be held by the caller.
+ * RETURN VALUE
+ *    Does not return a value.
+ */
+static void printRoots(perft_pool *Pool)
+{
+  const perft_root *Root;
+  char MoveStr[8];
+
+  while (Pool->nPrinted < Pool->nRoots
+      && Pool->Roots[Pool->nPrinted].Pending == 0)
+  {
+    Root = &Pool->Roots[Pool->nPrinted++];
+    getLANStr(Root->Move, MoveStr);
+    printf("%s: %"_u64" (%"_i64".%.3"_i64"s)\n", MoveStr, Root->Count,
+        toSeconds(Root->Time), mSecPart(Root->Time));
+  }
+  fflush(stdout);
+}
+
+/******************************************************************************
+ * void perftWorker(perft_pool *Pool);
+ * PARAMETERS
+ *    Pool - the pool to take jobs from.
+ * DESCRIPTION
+ *    Takes jobs from Pool and counts their variations until there are none
+ *    left, adding the results to the root move each job belongs to.
+ * RETURN VALUE
+ *    Does not return a value.
+ */
+static void perftWorker(perft_pool *Pool)
 {
-  static char MoveStr[8];
-  position NewPos;
+  perft_job *Job;
+  perft_root *Root;
+  uint64 Count;
+  microtime Time;
+
+  for (;;)
+  {
+    pthread_mutex_lock(&Pool->Lock);
+    Job = (Pool->NextJob < Pool->nJobs)? &Pool->Jobs[Pool->NextJob++] : NULL;
+    pthread_mutex_unlock(&Pool->Lock);
+    if (!Job)
+      break;
+
+    Nodes = 0;
+    Time = getMicroTime();
+    Count = countVariations(&Job->Pos, Pool->Depth);
+    Time = getMicroTime() - Time;
+
+    pthread_mutex_lock(&Pool->Lock);
+    Root = &Pool->Roots[Job->Root];
+    Root->Count += Count;
+    Root->Nodes += Nodes;
+    Root->Time += Time;
+    Root->Pending--;
+    if (Pool->Verbose)
+      printRoots(Pool);
+    pthread_mutex_unlock(&Pool->Lock);
+  }
+}
+
+static void *perftThread(void *Pool)
+{
+  perftWorker(Pool);
+  freeMoveStack();
+  return NULL;
+}
+
+/******************************************************************************
+ * int addJob(perft_pool *Pool, const position *Pos, int Root);
+ * PARAMETERS
+ *    Pool - the pool to add the job to.
+ *    Pos - the position to count variations from.
+ *    Root - index of the root move that Pos descends from.
+ * DESCRIPTION
+ *    Adds a job to Pool, growing the job list as needed.
+ * RETURN VALUE
+ *    Returns zero on success, or -1 if memory couldn't be allocated.
+ */
+static int addJob(perft_pool *Pool, const position *Pos, int Root)
+{
+  perft_job *Jobs;
+
+  // grow whenever the count reaches a power of two
+  if ((Pool->nJobs & (Pool->nJobs-1)) == 0)
+  {
+    Jobs = realloc(Pool->Jobs, sizeof(perft_job[Pool->nJobs ? 2*Pool->nJobs
+        : 64]));
+    if (!Jobs)
+      return -1;
+    Pool->Jobs = Jobs;
+  }
+
+  Pool->Jobs[Pool->nJobs].Pos = *Pos;
+  Pool->Jobs[Pool->nJobs].Root = Root;
+  Pool->Roots[Root].Pending++;
+  Pool->nJobs++;
+
+  return 0;
+}
+
+/******************************************************************************
+ * int countParallel(position *Pos, int Depth, int nThreads, int Verbose,
+ *                   uint64 *Count);
+ * PARAMETERS
+ *    Pos - the position to count variations from.
+ *    Depth - the depth to count to. Must be at least 1.
+ *    nThreads - the number of threads to count with.
+ *    Verbose - non-zero to print the count for each root move.
+ *    Count - receives the total number of variations.
+ * DESCRIPTION
+ *    Counts the variations of Pos on nThreads threads, each with its own move
+ *    stack. The positions after each root move, or after each reply when
+ *    there are several threads and enough depth, are handed out as jobs, and
+ *    the results are merged per root move. The Nodes counter of the calling
+ *    thread receives the total number of nodes visited.
+ * RETURN VALUE
+ *    Returns the number of legal root moves, or -1 on failure.
+ */
+static int countParallel(position *Pos, int Depth, int nThreads, int Verbose,
+    uint64 *Count)
+{
+  const int SplitPly = (nThreads > 1 && Depth > 2)? 2 : 1;
+  perft_pool Pool;
+  pthread_t *Threads;
+  position Child;
+  checkinfo CI;
+  undo Undo;
+  int MvBase, MvBase2;
+  int nThreadsStarted = 0;
+  int i, j, n;
+
+  memset(&Pool, 0, sizeof(Pool));
+  Pool.Depth = Depth - SplitPly;
+  Pool.Verbose = Verbose;
+
+  MvBase = getMoveStackTop();
+  if (Pos->Flags & PF_CHECK)
+    Pool.nRoots = genCheckEvasions(Pos);
+  else
+  {
+    getCheckInfo(Pos, &CI);
+    Pool.nRoots = genCaptures(Pos, &CI) + genQuietMoves(Pos, &CI);
+  }
+  Pool.Roots = calloc(Pool.nRoots ? Pool.nRoots : 1, sizeof(perft_root));
+  Threads = malloc(sizeof(pthread_t[nThreads]));
+  if (!Pool.Roots || !Threads)
+    goto failed;
+
+  // make the jobs
+  for (i = 0; i < Pool.nRoots; i++)
+  {
+    Pool.Roots[i].Move = MoveStack[MvBase + i];
+    Child = *Pos;
+    makeMove(&Child, Pool.Roots[i].Move, &Undo);
+    if (SplitPly == 1)
+    {
+      if (addJob(&Pool, &Child, i) != 0)
+        goto failed;
+      continue;
+    }
+
+    Pool.Roots[i].Nodes = 1; // the position after the root move
+    MvBase2 = getMoveStackTop();
+    if (Child.Flags & PF_CHECK)
+      n = genCheckEvasions(&Child);
+    else
+    {
+      getCheckInfo(&Child, &CI);
+      n = genCaptures(&Child, &CI) + genQuietMoves(&Child, &CI);
+    }
+    for (j = 0; j < n; j++)
+    {
+      makeMove(&Child, MoveStack[MvBase2 + j], &Undo);
+      if (addJob(&Pool, &Child, i) != 0)
+        goto failed;
+      unmakeMove(&Child, MoveStack[MvBase2 + j], &Undo);
+    }
+    popMoveStack(MvBase2);
+  }
+  popMoveStack(MvBase);
+
+  // start the helper threads and join in with the work
+  pthread_mutex_init(&Pool.Lock, NULL);
+  while (nThreadsStarted < nThreads-1 && pthread_create(
+      &Threads[nThreadsStarted], NULL, perftThread, &Pool) == 0)
+    nThreadsStarted++;
+  if (Verbose)
+    printRoots(&Pool); // root moves without any jobs
+  perftWorker(&Pool);
+  for (i = 0; i < nThreadsStarted; i++)
+    pthread_join(Threads[i], NULL);
+  pthread_mutex_destroy(&Pool.Lock);
+
+  // merge the results in root move order
+  *Count = 0;
+  Nodes = 1;
+  for (i = 0; i < Pool.nRoots; i++)
+  {
+    *Count += Pool.Roots[i].Count;
+    Nodes += Pool.Roots[i].Nodes;
+  }
+
+  free(Threads);
+  free(Pool.Jobs);
+  free(Pool.Roots);
+  return Pool.nRoots;
+
+failed:
+  popMoveStack(MvBase);
+  free(Threads);
+  free(Pool.Jobs);
+  free(Pool.Roots);
+  return -1;
+}
+
+static int64 mgtestCount(position *Pos, int Depth)
+{
+  char MoveStr[8];
+  position OldPos;
+  checkinfo CI;
+  undo Undo;
+  move Move;
   int MvBase;
   int nMoves;
   int64 Count;
@@ -95,14 +497,32 @@ static int64 mgtestCount(const position *Pos, int Depth)
     return 1;
 
   MvBase = getMoveStackTop();
-  nMoves = genCaptures(Pos) + genQuietMoves(Pos);
+  getCheckInfo(Pos, &CI);
+  nMoves = genCaptures(Pos, &CI) + genQuietMoves(Pos, &CI);
+
+  // the evasion generator must find the same number of moves as the regular
+  // generators; the moves themselves are checked by the variation counts
+  if (Pos->Flags & PF_CHECK)
+  {
+    popMoveStack(MvBase);
+    Count = nMoves;
+    nMoves = genCheckEvasions(Pos);
+    if (nMoves != Count)
+    {
+      fprintf(stderr, "\nEvasion count mismatch (%i instead of %"_i64"):\n",
+          nMoves, Count);
+      fprintf(stderr, "FEN: %s\n", exportFEN(FENStr, Pos));
+      return -1;
+    }
+  }
 
   for (i = 0; i < nMoves; i++)
   {
     // test the move verification functions
-    getCoordStr(MoveStack[MvBase + i], MoveStr);
-    if (expandMove(Pos, coordToHashMove(MoveStr), &TmpMove) != 0
-        || memcmp(&TmpMove, &MoveStack[MvBase + i], sizeof(move)) != 0)
+    Move = MoveStack[MvBase + i];
+    getCoordStr(Move, MoveStr);
+    if (expandMove(Pos, &CI, coordToHashMove(MoveStr), &TmpMove) != 0
+        || TmpMove != Move)
     {
       fprintf(stderr, "\nMove verification failed:\n");
       fprintf(stderr, "FEN: %s\n", exportFEN(FENStr, Pos));
@@ -110,19 +530,27 @@ static int64 mgtestCount(const position *Pos, int Depth)
       return -1;
     }
     
-    NewPos = *Pos;
-    if (quickMakeMove(&NewPos, MoveStack[MvBase + i]) == 0)
+    OldPos = *Pos;
+    if (makeMove(Pos, Move, &Undo) == 0)
     {
-      if (!isConsistent(&NewPos))
+      if (!isConsistent(Pos))
       {
         fprintf(stderr, "\nInconsistent position as result of move:\n");
-        fprintf(stderr, "FEN: %s\n", exportFEN(FENStr, Pos));
+        fprintf(stderr, "FEN: %s\n", exportFEN(FENStr, &OldPos));
         fprintf(stderr, "Move: %s\n", MoveStr);
         return -1;
       }
-      Count = mgtestCount(&NewPos, Depth-1);
+      Count = mgtestCount(Pos, Depth-1);
+      unmakeMove(Pos, Move, &Undo);
       if (Count < 0)
         return -1;
+      if (!isSamePosition(Pos, &OldPos))
+      {
+        fprintf(stderr, "\nPosition not restored after unmaking move:\n");
+        fprintf(stderr, "FEN: %s\n", exportFEN(FENStr, &OldPos));
+        fprintf(stderr, "Move: %s\n", MoveStr);
+        return -1;
+      }
       Total += Count;
     }
   }
@@ -132,35 +560,178 @@ static int64 mgtestCount(const position *Pos, int Depth)
   return Total;
 }
 
-int mgtest(const char *FileName)
+/* lines and tests of an EPD file for checking on several threads */
+typedef struct mgtest_line {
+  position Pos;
+  int LineNum;
+} mgtest_line;
+
+typedef struct mgtest_task {
+  int Line;         // index of the line the test belongs to
+  int Depth;
+  int64 ExpCount;   // expected number of variations
+  int64 Count;      // number of variations found, or -1 on error
+  uint64 Nodes;
+  microtime Time;
+  int Done;
+} mgtest_task;
+
+typedef struct mgtest_pool {
+  const mgtest_line *Lines;
+  mgtest_task *Tasks;
+  int nTasks;
+  int NextTask;     // index of the next task to hand out
+  int nPrinted;     // number of tasks printed so far
+  int Failed;       // set once a printed task has failed
+  uint64 Nodes;     // total nodes of the printed tasks
+  pthread_mutex_t Lock;
+} mgtest_pool;
+
+/******************************************************************************
+ * void printTasks(mgtest_pool *Pool);
+ * PARAMETERS
+ *    Pool - the pool being worked on.
+ * DESCRIPTION
+ *    Prints the results of any completed tests in input order, stopping at
+ *    the first failure. Pool->Lock must be held by the caller.
+ * RETURN VALUE
+ *    Does not return a value.
+ */
+static void printTasks(mgtest_pool *Pool)
+{
+  const mgtest_task *Task;
+  const mgtest_line *Line;
+
+  while (!Pool->Failed && Pool->nPrinted < Pool->nTasks
+      && Pool->Tasks[Pool->nPrinted].Done)
+  {
+    Task = &Pool->Tasks[Pool->nPrinted];
+    Line = &Pool->Lines[Task->Line];
+    if (Pool->nPrinted == 0
+        || Pool->Tasks[Pool->nPrinted-1].Line != Task->Line)
+      printf("Line %i: %s\n", Line->LineNum, exportFEN(FENStr, &Line->Pos));
+
+    printf("    Depth: %i Exp. Variations: %12"_i64"    ", Task->Depth,
+        Task->ExpCount);
+    if (Task->Count < 0)
+    {
+      Pool->Failed = 1;
+      break;
+    }
+    printf("Time: %"_i64".%.3"_i64"s ", toSeconds(Task->Time),
+        mSecPart(Task->Time));
+    if (Task->Time)
+      printf("(%"_u64" n/s)\n", (Task->Nodes*ONE_SEC)/Task->Time);
+    else
+      printf("(%"_u64"+ n/s)\n", Task->Nodes);
+    if (Task->Count != Task->ExpCount)
+    {
+      printf("ERROR: line %i data does not match\n\n", Line->LineNum);
+      Pool->Failed = 1;
+      break;
+    }
+
+    Pool->Nodes += Task->Nodes;
+    Pool->nPrinted++;
+  }
+  fflush(stdout);
+}
+
+/******************************************************************************
+ * void mgtestWorker(mgtest_pool *Pool);
+ * PARAMETERS
+ *    Pool - the pool to take tests from.
+ * DESCRIPTION
+ *    Takes tests from Pool and runs them until there are none left or one of
+ *    them has failed.
+ * RETURN VALUE
+ *    Does not return a value.
+ */
+static void mgtestWorker(mgtest_pool *Pool)
 {
+  mgtest_task *Task;
   position Pos;
+
+  for (;;)
+  {
+    pthread_mutex_lock(&Pool->Lock);
+    Task = (!Pool->Failed && Pool->NextTask < Pool->nTasks)?
+        &Pool->Tasks[Pool->NextTask++] : NULL;
+    pthread_mutex_unlock(&Pool->Lock);
+    if (!Task)
+      break;
+
+    Pos = Pool->Lines[Task->Line].Pos;
+    Nodes = 0;
+    resetMoveStack();
+    Task->Time = getMicroTime();
+    Task->Count = mgtestCount(&Pos, Task->Depth);
+    Task->Time = getMicroTime() - Task->Time;
+    Task->Nodes = Nodes;
+
+    pthread_mutex_lock(&Pool->Lock);
+    Task->Done = 1;
+    printTasks(Pool);
+    pthread_mutex_unlock(&Pool->Lock);
+  }
+}
+
+static void *mgtestThread(void *Pool)
+{
+  mgtestWorker(Pool);
+  freeMoveStack();
+  return NULL;
+}
+
+/******************************************************************************
+ * int readEPDFile(const char *FileName, mgtest_line **Lines,
+ *                 mgtest_task **Tasks);
+ * PARAMETERS
+ *    FileName - the EPD file to read.
+ *    Lines - receives a malloc'ed list of the positions in the file.
+ *    Tasks - receives a malloc'ed list of the tests in the file.
+ * DESCRIPTION
+ *    Reads the positions and expected variation counts of an EPD file.
+ * RETURN VALUE
+ *    Returns the number of tests, or -1 on failure.
+ */
+static int readEPDFile(const char *FileName, mgtest_line **Lines,
+    mgtest_task **Tasks)
+{
   FILE *File;
   char Line[512];
   char *Str;
+  void *Mem;
   int LineNum = 1;
+  int nLines = 0, nTasks = 0;
   int Depth;
-  int64 ExpCount, Count;
-  microtime Time, TotalTime;
+  int64 ExpCount;
 
+  *Lines = NULL;
+  *Tasks = NULL;
   File = fopen(FileName, "r");
   if (!File)
   {
     perror(FileName);
-    return 1;
+    return -1;
   }
 
-  TotalTime = getMicroTime();
   while (fgets(Line, 511, File))
   {
-    if (importFEN(&Pos, Line) != 0)
+    // grow whenever the count reaches a power of two
+    if ((nLines & (nLines-1)) == 0)
+    {
+      Mem = realloc(*Lines, sizeof(mgtest_line[nLines ? 2*nLines : 16]));
+      if (!Mem)
+        goto out_of_memory;
+      *Lines = Mem;
+    }
+    if (importFEN(&(*Lines)[nLines].Pos, Line) != 0)
     {
       fprintf(stderr, "%s: line %i: invalid FEN\n\n", FileName, LineNum);
-      fclose(File);
-      return 1;
+      goto failed;
     }
-
-    printf("Line %i: %s\n", LineNum, exportFEN(FENStr, &Pos));
+    (*Lines)[nLines].LineNum = LineNum;
 
     Str = Line;
     while ((Str = strchr(Str + 1, ';')))
@@ -168,56 +739,99 @@ int mgtest(const char *FileName)
       if (sscanf(Str, " ;D%i %"_i64, &Depth, &ExpCount) != 2)
       {
         fprintf(stderr, "%s: line %i: invalid data\n\n", FileName, LineNum);
-        fclose(File);
-        return 1;
+        goto failed;
       }
-
-      printf("    Depth: %i Exp. Variations: %12"_i64"    ", Depth, ExpCount);
-      Nodes = 0;
-      resetMoveStack();
-      Time = getMicroTime();
-      Count = mgtestCount(&Pos, Depth);
-      Time = getMicroTime() - Time;
-      if (Count < 0)
+      if ((nTasks & (nTasks-1)) == 0)
       {
-        fclose(File);
-        return 1;
+        Mem = realloc(*Tasks, sizeof(mgtest_task[nTasks ? 2*nTasks : 16]));
+        if (!Mem)
+          goto out_of_memory;
+        *Tasks = Mem;
       }
-      printf("Time: %"_i64".%.3"_i64"s ", toSeconds(Time), mSecPart(Time));
-      if (Time)
-        printf("(%"_u64" n/s)\n", (Nodes*ONE_SEC)/Time);
-      else
-        printf("(%"_u64"+ n/s)\n", Nodes);
-      if (Count != ExpCount)
-      {
-        printf("ERROR: line %i data does not match\n\n", LineNum);
-        fclose(File);
-        return 1;
-      }
-    };
+      memset(&(*Tasks)[nTasks], 0, sizeof(mgtest_task));
+      (*Tasks)[nTasks].Line = nLines;
+      (*Tasks)[nTasks].Depth = Depth;
+      (*Tasks)[nTasks].ExpCount = ExpCount;
+      nTasks++;
+    }
 
+    nLines++;
     LineNum++;
   }
+  fclose(File);
+
+  return nTasks;
+
+out_of_memory:
+  fprintf(stderr, "%s: out of memory\n\n", FileName);
+failed:
+  fclose(File);
+  free(*Lines);
+  free(*Tasks);
+  *Lines = NULL;
+  *Tasks = NULL;
+  return -1;
+}
+
+int mgtest(const char *FileName, int nJobs)
+{
+  mgtest_line *Lines;
+  mgtest_pool Pool;
+  pthread_t *Threads;
+  int nThreadsStarted = 0;
+  int i;
+  microtime TotalTime;
+
+  memset(&Pool, 0, sizeof(Pool));
+  Pool.nTasks = readEPDFile(FileName, &Lines, &Pool.Tasks);
+  if (Pool.nTasks < 0)
+    return 1;
+  Pool.Lines = Lines;
+  Threads = malloc(sizeof(pthread_t[nJobs]));
+  if (!Threads)
+  {
+    fprintf(stderr, "%s: out of memory\n\n", FileName);
+    free(Lines);
+    free(Pool.Tasks);
+    return 1;
+  }
+
+  // start the helper threads and join in with the work
+  TotalTime = getMicroTime();
+  pthread_mutex_init(&Pool.Lock, NULL);
+  while (nThreadsStarted < nJobs-1 && pthread_create(
+      &Threads[nThreadsStarted], NULL, mgtestThread, &Pool) == 0)
+    nThreadsStarted++;
+  mgtestWorker(&Pool);
+  for (i = 0; i < nThreadsStarted; i++)
+    pthread_join(Threads[i], NULL);
+  pthread_mutex_destroy(&Pool.Lock);
   TotalTime = getMicroTime() - TotalTime;
 
+  free(Threads);
+  free(Lines);
+  free(Pool.Tasks);
+  if (Pool.Failed)
+    return 1;
+
   printf("Move generation test completed.\n");
+  printf("Total Nodes: %"_u64" \t", Pool.Nodes);
+  if (TotalTime)
+    printf("Rate: %"_u64" n/s\n", (Pool.Nodes*ONE_SEC)/TotalTime);
+  else
+    printf("Rate: %"_u64"+ n/s\n", Pool.Nodes);
   printf("Total Time (m:ss): %"_i64":%.2"_i64"\n\n",
          toMinutes(TotalTime), secondsPart(TotalTime));
-  fclose(File);
 
   return 0;
 }
 
-int printVariations(const char *Fen, int Depth)
+int printVariations(const char *Fen, int Depth, uint64 HashMB, int nThreads)
 {
   position Pos;
-  position NewPos;
-  int MvBase;
-  int nMoves, nLegalMoves = 0;
-  uint64 n, Total = 0;
-  char MoveStr[8];
-  int i;
-  microtime Time, TotalTime;
+  int nLegalMoves;
+  uint64 Total;
+  microtime TotalTime;
 
   if (!Fen) {
     Fen = STARTPOS;
@@ -227,30 +841,26 @@ int printVariations(const char *Fen, int Depth)
     fprintf(stderr, "Invalid FEN:\n  %s\n", Fen);
     return 1;
   }
-  printf("\nPosition: %s\nDepth: %i ply\n\n", Fen, Depth);
+  printf("\nPosition: %s\nDepth: %i ply\n", Fen, Depth);
+  if (nThreads > 1)
+    printf("Threads: %i\n", nThreads);
+  if (HashMB && !initPerftHash(HashMB * MEGABYTE)) {
+    fprintf(stderr, "Cannot allocate perft hash of %"_u64"MB\n", HashMB);
+    return 1;
+  }
+  if (PerftTable)
+    printf("Hash: %"_u64"MB\n", (PerftMask+1)*sizeof(perft_buckets)/MEGABYTE);
+  printf("\n");
   resetMoveStack();
 
   TotalTime = getMicroTime();
-  Nodes = 1;
-  MvBase = getMoveStackTop();
-  nMoves = genCaptures(&Pos) + genQuietMoves(&Pos);
-  for (i = 0; i < nMoves; i++)
-  {
-    NewPos = Pos;
-    if (quickMakeMove(&NewPos, MoveStack[MvBase + i]) == 0)
-    {
-      Time = getMicroTime();
-      n = countVariations(&NewPos, Depth-1);
-      Time = getMicroTime() - Time;
-      Total += n;
-      getLANStr(MoveStack[MvBase + i], MoveStr);
-      printf("%s: %"_u64" (%"_i64".%.3"_i64"s)\n", MoveStr, n,
-          toSeconds(Time), mSecPart(Time));
-      nLegalMoves++;
-    }
-  }
-  popMoveStack(MvBase);
+  nLegalMoves = countParallel(&Pos, Depth, nThreads, 1, &Total);
   TotalTime = getMicroTime() - TotalTime;
+  if (nLegalMoves < 0) {
+    fprintf(stderr, "Out of memory\n");
+    freePerftHash();
+    return 1;
+  }
 
   printf("Legal moves: %i\n", nLegalMoves);
   printf("\nNodes: %"_u64" \tTime: %"_i64".%.3"_i64"s \t",
@@ -260,11 +870,12 @@ int printVariations(const char *Fen, int Depth)
   else
     printf("Rate: %"_u64"+ n/s\n", Nodes);
   printf("Total variations: %"_u64"\n\n", Total);
+  freePerftHash();
 
   return 0;
 }
 
-int perftest(const char *Fen, int Depth)
+int perftest(const char *Fen, int Depth, uint64 HashMB, int nThreads)
 {
   uint64 Count;
   microtime Time;
@@ -278,12 +889,24 @@ int perftest(const char *Fen, int Depth)
     fprintf(stderr, "Invalid FEN:\n  %s\n", Fen);
     return 1;
   }
-  printf("\nPosition: %s\nDepth: %i ply\n\n", Fen, Depth);
+  printf("\nPosition: %s\nDepth: %i ply\n", Fen, Depth);
+  if (nThreads > 1)
+    printf("Threads: %i\n", nThreads);
+  if (HashMB && !initPerftHash(HashMB * MEGABYTE)) {
+    fprintf(stderr, "Cannot allocate perft hash of %"_u64"MB\n", HashMB);
+    return 1;
+  }
+  if (PerftTable)
+    printf("Hash: %"_u64"MB\n", (PerftMask+1)*sizeof(perft_buckets)/MEGABYTE);
+  printf("\n");
 
-  Nodes = 0;
   resetMoveStack();
   Time = getMicroTime();
-  Count = countVariations(&Pos, Depth);
+  if (countParallel(&Pos, Depth, nThreads, 0, &Count) < 0) {
+    fprintf(stderr, "Out of memory\n");
+    freePerftHash();
+    return 1;
+  }
   Time = getMicroTime() - Time;
 
   printf("Nodes: %"_u64" \tTime: %"_i64".%.3"_i64"s \t",
@@ -293,6 +916,126 @@ int perftest(const char *Fen, int Depth)
   else
     printf("Rate: %"_u64"+ n/s\n", Nodes);
   printf("Total variations: %"_u64"\n", Count);
+  freePerftHash();
+
+  return 0;
+}
+
+#define SLIDERTEST_OCCS   4096  // number of random occupancies to test
+#define SLIDERTEST_ROUNDS 2000  // number of passes made over the occupancies
+
+/******************************************************************************
+ * microtime timeSliders(const bitboard *Occ, int UseLines, bitboard *Sum);
+ * PARAMETERS
+ *    Occ - array of SLIDERTEST_OCCS occupancies.
+ *    UseLines - non-zero to use the line attack functions rather than
+ *        bishopAtt() and rookAtt().
+ *    Sum - receives a checksum of the results, so they aren't optimized away.
+ * DESCRIPTION
+ *    Times SLIDERTEST_ROUNDS passes of bishop and rook lookups over Occ.
+ * RETURN VALUE
+ *    Returns the time taken.
+ */
+static microtime timeSliders(const bitboard *Occ, int UseLines, bitboard *Sum)
+{
+  microtime Time = getMicroTime();
+  bitboard Bd = 0;
+  square Sq;
+  int r, i;
+
+  for (r = 0; r < SLIDERTEST_ROUNDS; r++)
+  {
+    for (i = 0; i < SLIDERTEST_OCCS; i++)
+    {
+      Sq = (i + r) & 077;
+      if (UseLines)
+        Bd += diagonalAtt(Occ[i], Sq) | antidiagAtt(Occ[i], Sq)
+            | rankAtt(Occ[i], Sq) | fileAtt(Occ[i], Sq);
+      else
+        Bd += bishopAtt(Occ[i], Sq) | rookAtt(Occ[i], Sq);
+    }
+  }
+
+  *Sum = Bd;
+  return getMicroTime() - Time;
+}
+
+static void printLookupRate(const char *Name, microtime Time)
+{
+  const uint64 Lookups = 2*(uint64)SLIDERTEST_OCCS*SLIDERTEST_ROUNDS;
+
+  printf("%-10s Time: %"_i64".%.3"_i64"s \t", Name, toSeconds(Time),
+      mSecPart(Time));
+  if (Time)
+    printf("Rate: %"_u64" lookups/s\n", (Lookups*ONE_SEC)/Time);
+  else
+    printf("Rate: %"_u64"+ lookups/s\n", Lookups);
+}
+
+int slidertest(void)
+{
+  static bitboard Occ[SLIDERTEST_OCCS];
+  const sliderbackend Selected = SliderBackend;
+  uint64 Seed = 0x9e3779b97f4a7c15ULL;
+  bitboard Sum, RefSum;
+  sliderbackend b;
+  microtime Time;
+  square Sq;
+  int i;
+
+  // random occupancies with roughly a quarter of the squares occupied
+  for (i = 0; i < SLIDERTEST_OCCS; i++)
+  {
+    Seed = Seed*6364136223846793005ULL + 1442695040888963407ULL;
+    Occ[i] = Seed;
+    Seed = Seed*6364136223846793005ULL + 1442695040888963407ULL;
+    Occ[i] &= Seed;
+  }
+
+  printf("\nBMI2 supported: %s\n", hasBMI2()? "yes" : "no");
+  printf("Lookups per test: %"_u64"\n\n",
+      2*(uint64)SLIDERTEST_OCCS*SLIDERTEST_ROUNDS);
+
+  Time = timeSliders(Occ, 1, &RefSum);
+  printLookupRate("hyperbola", Time);
+
+  for (b = 0; b < NUM_SLIDER_BACKENDS; b++)
+  {
+    if (setSliderBackend(b) != 0)
+    {
+      printf("%-10s not supported by this processor\n",
+          SLIDER_BACKEND_NAME[b]);
+      continue;
+    }
+
+    // verify against the line attack functions before timing
+    for (i = 0; i < SLIDERTEST_OCCS; i++)
+    {
+      Sq = i & 077;
+      if (bishopAtt(Occ[i], Sq)
+            != (diagonalAtt(Occ[i], Sq) | antidiagAtt(Occ[i], Sq))
+          || rookAtt(Occ[i], Sq) != (rankAtt(Occ[i], Sq) | fileAtt(Occ[i], Sq)))
+      {
+        printf("ERROR: %s backend gives wrong attacks from %s\n",
+            SLIDER_BACKEND_NAME[b], SQUARE_NAME[Sq]);
+        setSliderBackend(Selected);
+        return 1;
+      }
+    }
+
+    Time = timeSliders(Occ, 0, &Sum);
+    printLookupRate(SLIDER_BACKEND_NAME[b], Time);
+    if (Sum != RefSum)
+    {
+      printf("ERROR: %s backend checksum does not match\n",
+          SLIDER_BACKEND_NAME[b]);
+      setSliderBackend(Selected);
+      return 1;
+    }
+  }
+
+  setSliderBackend(Selected);
+  printf("\nSelected backend: %s\n\n", SLIDER_BACKEND_NAME[Selected]);
 
   return 0;
 }
@@ -12,11 +12,13 @@
 
 #include "vapor.h"
 
-int mgtest(const char *FileName);
+int mgtest(const char *FileName, int nJobs);
 
-int printVariations(const char *Fen, int Depth);
+int printVariations(const char *Fen, int Depth, uint64 HashMB, int nThreads);
 
-int perftest(const char *Fen, int Depth);
+int perftest(const char *Fen, int Depth, uint64 HashMB, int nThreads);
+
+int slidertest(void);
 
 #endif // #ifndef VAPOR__MGTEST_H
 
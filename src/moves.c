@@ -9,23 +9,35 @@
 
 #include "moves.h"
 #include "zobrist.h"
+#include "eval.h"
 
 #include <stdlib.h>
-#include <string.h>
 
-const bitboard KNIGHT_ATT[NUM_SQUARES];
-const bitboard KING_ATT[NUM_SQUARES];
-const bitboard FILE_ATT[NUM_RANKS][64];
+bitboard KNIGHT_ATT[NUM_SQUARES];
+bitboard KING_ATT[NUM_SQUARES];
+bitboard FILE_ATT[NUM_RANKS][64];
+bitboard BETWEEN[NUM_SQUARES][NUM_SQUARES];
+bitboard LINE[NUM_SQUARES][NUM_SQUARES];
+
+magic BISHOP_MAGIC[NUM_SQUARES];
+magic ROOK_MAGIC[NUM_SQUARES];
+bitboard BISHOP_ATT[BISHOP_ATT_SIZE];
+bitboard ROOK_ATT[ROOK_ATT_SIZE];
+
+sliderbackend SliderBackend = SB_MAGIC;
+const char *const SLIDER_BACKEND_NAME[NUM_SLIDER_BACKENDS] = {
+    "magic", "pext",
+};
 
 const bitboard PROM_RANKS = RANKMASK(R_1) | RANKMASK(R_8);
 
 
 #define MIN_MVSTACK_SIZE  512
 
-static move *MvStack = NULL;
-const move *MoveStack = NULL;
-int StackSize = 0;
-int StackTop  = 0;
+static THREAD_LOCAL move *MvStack = NULL;
+THREAD_LOCAL const move *MoveStack = NULL;
+static THREAD_LOCAL int StackSize = 0;
+static THREAD_LOCAL int StackTop  = 0;
 
 void resetMoveStack(void)
 {
@@ -40,6 +52,15 @@ void resetMoveStack(void)
   StackTop = 0;
 }
 
+void freeMoveStack(void)
+{
+  free(MvStack);
+  MvStack = NULL;
+  MoveStack = NULL;
+  StackSize = 0;
+  StackTop = 0;
+}
+
 int getMoveStackTop(void)
 {
   if (!MvStack)
@@ -57,7 +78,7 @@ int popMoveStack(int NewTop)
   return StackTop;
 }
 
-static inline int pushMove(const move *Move)
+static inline int pushMove(move Move)
 {
   if (!MvStack)
     resetMoveStack();
@@ -69,35 +90,241 @@ static inline int pushMove(const move *Move)
     assert(MvStack);
   }
 
-  MvStack[StackTop] = *Move;
+  MvStack[StackTop] = Move;
 
   return StackTop++;
 }
 
-int expandMove(const position *Pos, hashmove HashMove, move *Move)
+/******************************************************************************
+ * piece pieceOn(const position *Pos, color Color, square Sq);
+ * PARAMETERS
+ *    Pos - pointer to the position.
+ *    Color - the color of the piece on Sq.
+ *    Sq - the square to examine.
+ * DESCRIPTION
+ *    Finds the type of Color's piece on Sq.
+ * RETURN VALUE
+ *    Returns the piece, or NO_PIECE if Color has no piece on Sq.
+ */
+static inline piece pieceOn(const position *Pos, color Color, square Sq)
+{
+  piece p;
+
+  if (!TESTSQ(Pos->OccBy[Color][0], Sq))
+    return NO_PIECE;
+  for (p = PAWN; p < KING; p++)
+  {
+    if (TESTSQ(Pos->OccBy[Color][p], Sq))
+      return p;
+  }
+  return KING;
+}
+
+/******************************************************************************
+ * bitboard pinnedPieces(const position *Pos, color Mover, square KingSq);
+ * PARAMETERS
+ *    Pos - pointer to the position.
+ *    Mover - the color whose pieces may be pinned.
+ *    KingSq - the square of Mover's king.
+ * DESCRIPTION
+ *    Finds Mover's pieces that are the only piece between an enemy slider and
+ *    Mover's king.
+ * RETURN VALUE
+ *    Returns a bitboard of the pinned pieces.
+ */
+static inline bitboard pinnedPieces(const position *Pos, color Mover,
+    square KingSq)
+{
+  const bitboard *const Enemy = Pos->OccBy[!Mover];
+  bitboard Snipers;
+  bitboard Blockers;
+  bitboard Pinned = 0;
+
+  // enemy sliders that would attack the king on an otherwise empty board
+  Snipers = (rookAtt(0, KingSq) & (Enemy[ROOK] | Enemy[QUEEN]))
+      | (bishopAtt(0, KingSq) & (Enemy[BISHOP] | Enemy[QUEEN]));
+  for (; Snipers; CLEARLSB(Snipers))
+  {
+    Blockers = BETWEEN[KingSq][firstSq(Snipers)] & Pos->Occ;
+    if (Blockers && !(Blockers & (Blockers - 1)))
+      Pinned |= Blockers & Pos->OccBy[Mover][0];
+  }
+
+  return Pinned;
+}
+
+/******************************************************************************
+ * bitboard evasionTargets(const position *Pos, color Mover, square KingSq);
+ * PARAMETERS
+ *    Pos - pointer to the position.
+ *    Mover - the color on move.
+ *    KingSq - the square of Mover's king.
+ * DESCRIPTION
+ *    Determines the squares a piece other than the king may move to without
+ *    leaving the king in check, ignoring pins.
+ * RETURN VALUE
+ *    Returns every square if Mover is not in check, the checking piece and
+ *    the squares between it and the king if in single check, or no squares
+ *    if in double check.
+ */
+static inline bitboard evasionTargets(const position *Pos, color Mover,
+    square KingSq)
+{
+  bitboard Checkers;
+
+  if (!(Pos->Flags & PF_CHECK))
+    return ~(bitboard)0;
+
+  Checkers = attackersOf(Pos, KingSq, !Mover, Pos->Occ);
+  if (Checkers & (Checkers - 1))
+    return 0; // double check, only the king can move
+
+  return Checkers | BETWEEN[KingSq][firstSq(Checkers)];
+}
+
+/******************************************************************************
+ * bitboard legalDests(bitboard Pinned, bitboard Evasions, square KingSq,
+ *                     square Orig);
+ * PARAMETERS
+ *    Pinned - the mover's pinned pieces.
+ *    Evasions - the result of evasionTargets().
+ *    KingSq - the square of the mover's king.
+ *    Orig - the square of a piece other than the king.
+ * DESCRIPTION
+ *    Determines the squares the piece on Orig may legally move to, as far as
+ *    pins and checks are concerned.
+ * RETURN VALUE
+ *    Returns a bitboard of the squares.
+ */
+static inline bitboard legalDests(bitboard Pinned, bitboard Evasions,
+    square KingSq, square Orig)
+{
+  if (TESTSQ(Pinned, Orig))
+    return Evasions & LINE[KingSq][Orig];
+  else
+    return Evasions;
+}
+
+/******************************************************************************
+ * void getCheckInfo(const position *Pos, checkinfo *CI);
+ * PARAMETERS
+ *    Pos - pointer to the position.
+ *    CI - receives the pins and check evasion squares for *Pos.
+ * DESCRIPTION
+ *    Finds the mover's king, its pinned pieces and the squares that answer a
+ *    check, so that the generators and expandMove can share them within a
+ *    node instead of each finding them again.
+ */
+void getCheckInfo(const position *Pos, checkinfo *CI)
+{
+  const color Mover = (Pos->Flags & PF_WHITEMOVE)? WHITE : BLACK;
+
+  CI->KingSq = firstSq(Pos->OccBy[Mover][KING]);
+  CI->Pinned = pinnedPieces(Pos, Mover, CI->KingSq);
+  CI->Evasions = evasionTargets(Pos, Mover, CI->KingSq);
+}
+
+/******************************************************************************
+ * int kingMoveLegal(const position *Pos, color Mover, square Orig,
+ *                   square Dest);
+ * PARAMETERS
+ *    Pos - pointer to the position.
+ *    Mover - the color on move.
+ *    Orig - the square of Mover's king.
+ *    Dest - the square the king moves to.
+ * DESCRIPTION
+ *    Determines whether the king may move from Orig to Dest without being in
+ *    check. The king is removed from the board first, so it can't hide from
+ *    a slider behind itself.
+ * RETURN VALUE
+ *    Returns non-zero if the move is legal, or zero if it is not.
+ */
+static inline int kingMoveLegal(const position *Pos, color Mover,
+    square Orig, square Dest)
+{
+  return !attackedOcc(Pos, Dest, !Mover, Pos->Occ ^ SQMASK(Orig));
+}
+
+/******************************************************************************
+ * int epLegal(const position *Pos, color Mover, square KingSq, square Orig);
+ * PARAMETERS
+ *    Pos - pointer to the position.
+ *    Mover - the color on move.
+ *    KingSq - the square of Mover's king.
+ *    Orig - the square of the capturing pawn.
+ * DESCRIPTION
+ *    Determines whether capturing en passant from Orig leaves Mover's king
+ *    out of check. Two pawns leave the board's rank at once, so this is
+ *    tested directly rather than with pins.
+ * RETURN VALUE
+ *    Returns non-zero if the move is legal, or zero if it is not.
+ */
+static inline int epLegal(const position *Pos, color Mover, square KingSq,
+    square Orig)
+{
+  const square Dest = Pos->EPSquare;
+  const square CaptSq = SQUARE(FILE(Dest), RANK(Orig));
+  const bitboard Occ = (Pos->Occ ^ SQMASK(Orig) ^ SQMASK(CaptSq))
+      | SQMASK(Dest);
+
+  return !(attackersOf(Pos, KingSq, !Mover, Occ) & ~SQMASK(CaptSq));
+}
+
+/******************************************************************************
+ * int isLegal(const position *Pos, const checkinfo *CI, move Move);
+ * PARAMETERS
+ *    Pos - pointer to the position.
+ *    CI - the result of getCheckInfo() for *Pos.
+ *    Move - a pseudo-legal move in *Pos.
+ * DESCRIPTION
+ *    Determines whether Move leaves the mover's king out of check, including
+ *    the squares passed over when castling.
+ * RETURN VALUE
+ *    Returns non-zero if the move is legal, or zero if it is not.
+ */
+static int isLegal(const position *Pos, const checkinfo *CI, move Move)
+{
+  const color Mover = (Pos->Flags & PF_WHITEMOVE)? WHITE : BLACK;
+  const square KingSq = CI->KingSq;
+  const square Orig = getOrig(Move);
+  const square Dest = getDest(Move);
+
+  if (getMoveType(Move) == MT_CASTLE)
+    return !(Pos->Flags & PF_CHECK)
+        && !attacked(Pos, (Orig + Dest)/2, !Mover)
+        && !attacked(Pos, Dest, !Mover);
+  if (getPiece(Move) == KING)
+    return kingMoveLegal(Pos, Mover, Orig, Dest);
+  if (getCaptPc(Move) != NO_PIECE && Dest == Pos->EPSquare)
+    return epLegal(Pos, Mover, KingSq, Orig);
+
+  return (legalDests(CI->Pinned, CI->Evasions, KingSq, Orig)
+      & SQMASK(Dest)) != 0;
+}
+
+int expandMove(const position *Pos, const checkinfo *CI, hashmove HashMove,
+    move *Move)
 {
   static const int PAWN_SHIFT[2] = {7, 9};
   const color Mover = Pos->Flags & PF_WHITEMOVE;
   const int KingSide = Mover; // king-side element of PAWN_SHIFT array
+  const piece PromPc = getPromPc(HashMove);
+  const square Dest = getDest(HashMove);
+  const square Orig = getOrig(HashMove);
+  const bitboard DestBd = SQMASK(Dest);
+  const bitboard OrigBd = SQMASK(Orig);
   piece p;
   square ROrig = NO_SQUARE;
   square RDest = NO_SQUARE;
   bitboard Occ = Pos->Occ;
-  bitboard OrigBd;
-  bitboard DestBd;
-
-  memset(Move, 0, sizeof(move));
-  Move->Type = MT_INVALID;
+  piece Piece = NO_PIECE;
+  piece CaptPc = NO_PIECE;
+  movetype Type = MT_INVALID;
 
+  *Move = INVALID_MOVE;
   if (!HashMove)
     return -1;
 
-  Move->PromPc = HashMove & 7;
-  Move->Dest = (HashMove >> 3) & 077;
-  DestBd = SQMASK(Move->Dest);
-  Move->Orig = HashMove >> 9;
-  OrigBd = SQMASK(Move->Orig);
-
   // verify that mover has piece at Orig
   if (!(Pos->OccBy[Mover][0] & OrigBd))
     return -1;
@@ -110,11 +337,11 @@ int expandMove(const position *Pos, hashmove HashMove, move *Move)
   {
     if (Pos->OccBy[Mover][p] & OrigBd)
     {
-      Move->Piece = p;
+      Piece = p;
       break;
     }
   }
-  if (Move->Piece == NO_PIECE)
+  if (Piece == NO_PIECE)
     return -1;
 
   // find the captured piece if any
@@ -124,36 +351,36 @@ int expandMove(const position *Pos, hashmove HashMove, move *Move)
     {
       if (Pos->OccBy[!Mover][p] & DestBd)
       {
-        Move->CaptPc = p;
+        CaptPc = p;
         break;
       }
     }
   }
-  else if (Move->Dest == Pos->EPSquare && Move->Piece == PAWN)
-    Move->CaptPc = PAWN;
+  else if (Dest == Pos->EPSquare && Piece == PAWN)
+    CaptPc = PAWN;
 
   // determine the move type
-  if (Move->CaptPc == NO_PIECE && Move->PromPc == NO_PIECE)
+  if (CaptPc == NO_PIECE && PromPc == NO_PIECE)
   {
-    if (Move->Piece == PAWN)
+    if (Piece == PAWN)
     {
       // verify pawn doesn't jump over a piece
       // NOTE: (harmless for single-space pawn moves or captures)
-      if (!(fileAtt(Occ, Move->Orig) & DestBd))
+      if (!(fileAtt(Occ, Orig) & DestBd))
         return -1;
 
-      if (Mover == BLACK && Move->Orig - Move->Dest == 2)
-        Move->Type = MT_ADVANCE2;
-      else if (Mover == WHITE && Move->Dest - Move->Orig == 2)
-        Move->Type = MT_ADVANCE2;
+      if (Mover == BLACK && Orig - Dest == 2)
+        Type = MT_ADVANCE2;
+      else if (Mover == WHITE && Dest - Orig == 2)
+        Type = MT_ADVANCE2;
     }
-    else if (Move->Piece == KING)
+    else if (Piece == KING)
     {
       // determine if it can be a castling move
-      switch (Move->Dest)
+      switch (Dest)
       {
         case g1:
-          if (Move->Orig == e1 && Mover == WHITE && 
+          if (Orig == e1 && Mover == WHITE && 
               (Pos->Flags & PF_WKSCASTLE))
           {
             ROrig = h1;
@@ -161,7 +388,7 @@ int expandMove(const position *Pos, hashmove HashMove, move *Move)
           }
           break;
         case c1:
-          if (Move->Orig == e1 && Mover == WHITE && 
+          if (Orig == e1 && Mover == WHITE && 
               (Pos->Flags & PF_WQSCASTLE))
           {
             ROrig = a1;
@@ -169,7 +396,7 @@ int expandMove(const position *Pos, hashmove HashMove, move *Move)
           }
           break;
         case g8:
-          if (Move->Orig == e8 && Mover == BLACK && 
+          if (Orig == e8 && Mover == BLACK && 
               (Pos->Flags & PF_BKSCASTLE))
           {
             ROrig = h8;
@@ -177,7 +404,7 @@ int expandMove(const position *Pos, hashmove HashMove, move *Move)
           }
           break;
         case c8:
-          if (Move->Orig == e8 && Mover == BLACK && 
+          if (Orig == e8 && Mover == BLACK && 
               (Pos->Flags & PF_BQSCASTLE))
           {
             ROrig = a8;
@@ -196,58 +423,64 @@ int expandMove(const position *Pos, hashmove HashMove, move *Move)
         if (!(rankAtt(Occ, ROrig) & OrigBd))
           return -1;
 
-        Move->Type = MT_CASTLE;
+        Type = MT_CASTLE;
       }
     }
   }
-  if (Move->Type == MT_INVALID) {
-    switch (Move->Piece) {
+  if (Type == MT_INVALID) {
+    switch (Piece) {
       case PAWN:
         // make sure it's a promotion if dest is last rank
-        if (Move->PromPc == NO_PIECE && (RANK(Move->Dest) == R_8 || RANK(Move->Dest) == R_1))
+        if (PromPc == NO_PIECE && (RANK(Dest) == R_8 || RANK(Dest) == R_1))
           return -1;
 
-        if (Move->CaptPc) {
-          if (Move->Orig == Move->Dest + PAWN_SHIFT[!KingSide]
-                || Move->Orig == Move->Dest - PAWN_SHIFT[KingSide])
+        if (CaptPc) {
+          if (Orig == Dest + PAWN_SHIFT[!KingSide]
+                || Orig == Dest - PAWN_SHIFT[KingSide])
           {
-            Move->Type = MT_STANDARD;
+            Type = MT_STANDARD;
           }
         } else {
-          if (Mover == BLACK && Move->Orig - Move->Dest == 1)
-            Move->Type = MT_STANDARD;
-          else if (Mover == WHITE && Move->Dest - Move->Orig == 1)
-            Move->Type = MT_STANDARD;
+          if (Mover == BLACK && Orig - Dest == 1)
+            Type = MT_STANDARD;
+          else if (Mover == WHITE && Dest - Orig == 1)
+            Type = MT_STANDARD;
         }
         break;
       case KNIGHT:
-        if (KNIGHT_ATT[Move->Orig] & DestBd)
-          Move->Type = MT_STANDARD;
+        if (KNIGHT_ATT[Orig] & DestBd)
+          Type = MT_STANDARD;
         break;
       case BISHOP:
-        if ((diagonalAtt(Occ, Move->Orig) | antidiagAtt(Occ, Move->Orig)) & DestBd)
-          Move->Type = MT_STANDARD;
+        if (bishopAtt(Occ, Orig) & DestBd)
+          Type = MT_STANDARD;
         break;
       case ROOK:
-        if ((rankAtt(Occ, Move->Orig) | fileAtt(Occ, Move->Orig)) & DestBd)
-          Move->Type = MT_STANDARD;
+        if (rookAtt(Occ, Orig) & DestBd)
+          Type = MT_STANDARD;
         break;
       case QUEEN:
-        if ((diagonalAtt(Occ, Move->Orig) | antidiagAtt(Occ, Move->Orig)
-              | rankAtt(Occ, Move->Orig) | fileAtt(Occ, Move->Orig)) & DestBd)
-          Move->Type = MT_STANDARD;
+        if ((bishopAtt(Occ, Orig) | rookAtt(Occ, Orig)) & DestBd)
+          Type = MT_STANDARD;
         break;
       case KING:
-        if (KING_ATT[Move->Orig] & DestBd)
-          Move->Type = MT_STANDARD;
+        if (KING_ATT[Orig] & DestBd)
+          Type = MT_STANDARD;
         break;
       default:
         assert(0); // should never happen
     }
   }
-  if (Move->Type == MT_INVALID)
+  if (Type == MT_INVALID)
     return -1;
 
+  *Move = packMove(Piece, Orig, Dest, CaptPc, PromPc, Type);
+  if (!isLegal(Pos, CI, *Move))
+  {
+    *Move = INVALID_MOVE;
+    return -1;
+  }
+
   return 0;
 }
 
@@ -257,26 +490,29 @@ int expandMove(const position *Pos, hashmove HashMove, move *Move)
  *    Pos - pointer to the position structure on which the move is made.
  *    Move - the move and any additional data.
  * DESCRIPTION
- *    Makes Move on the board pointed to by Pos. Move must be a valid pseudo-
- *    legal move. A move is considered pseudo-legal if it is legal or would be
- *    legal if it did not leave the mover in check. If a move is not fully
- *    legal it is still made and the resulting position has the PF_INVALID flag
- *    set.
+ *    Makes Move on the board pointed to by Pos. Move must be a legal move.
  * RETURN VALUE
  *    Returns zero on success, -1 on failure.
  * !!!CAUTION!!!
- *    The only legality check is to ensure the move does not leave the mover in
- *    check. Results with non-pseudo-legal moves are undefined and could crash
- *    the program. Therefore, only moves returned by the move generation and
- *    verification functions should be passed to this function.
+ *    No legality checks are made. Results with illegal moves are undefined
+ *    and could crash the program. Therefore, only moves returned by the move
+ *    generation and verification functions should be passed to this function.
  */
 int quickMakeMove(position *Pos, move Move)
 {
   const color Mover = (Pos->Flags & PF_WHITEMOVE)? WHITE : BLACK;
+  const square EPSquare = Pos->EPSquare;
+  const piece Piece = getPiece(Move);
+  const piece CaptPc = getCaptPc(Move);
+  const piece PromPc = getPromPc(Move);
+  const square Orig = getOrig(Move);
+  const square Dest = getDest(Move);
+  const movetype Type = getMoveType(Move);
   register bitboard Mask;
   square Sq;
+  piece NewPc;
 
-  if (Move.Type == MT_INVALID)
+  if (Type == MT_INVALID)
     return -1;
 
   /* switch mover */
@@ -286,34 +522,36 @@ int quickMakeMove(position *Pos, move Move)
   /* move counts */
   if (Mover == BLACK)
     Pos->MoveNum++;
-  if (Move.Piece != PAWN && Move.CaptPc == NO_PIECE)
+  if (Piece != PAWN && CaptPc == NO_PIECE)
     Pos->DrawPlies++;
   else
     Pos->DrawPlies = 0;
 
   /* clear captured piece if any */
-  if (Move.CaptPc != NO_PIECE)
+  if (CaptPc != NO_PIECE)
   {
-    if (Move.Dest != Pos->EPSquare)
+    if (Dest != Pos->EPSquare)
     {
-      Mask = ~SQMASK(Move.Dest);
-      Pos->ZKey ^= Z_PLACEMENT[!Mover][Move.CaptPc][Move.Dest];
+      Sq = Dest;
     }
     else // en passant
     {
-      Sq = SQUARE(FILE(Move.Dest), RANK(Move.Orig));
-      Mask = ~SQMASK(Sq);
-      Pos->ZKey ^= Z_PLACEMENT[!Mover][Move.CaptPc][Sq];
+      Sq = SQUARE(FILE(Dest), RANK(Orig));
     }
+    Mask = ~SQMASK(Sq);
+    Pos->ZKey ^= Z_PLACEMENT[!Mover][CaptPc][Sq];
+    removePcSq(Pos, !Mover, CaptPc, Sq);
+    if (CaptPc == PAWN)
+      Pos->PawnKey ^= Z_PLACEMENT[!Mover][PAWN][Sq];
     Pos->Occ &= Mask;
     Pos->OccBy[!Mover][0] &= Mask;
-    Pos->OccBy[!Mover][Move.CaptPc] &= Mask;
+    Pos->OccBy[!Mover][CaptPc] &= Mask;
 
     // castling flags
     if (Pos->Flags & PF_CASTLEFLAGS)
     {
       Pos->ZKey ^= Z_CASTLE[(Pos->Flags & PF_CASTLEFLAGS) >> 8];
-      switch (Move.Dest)
+      switch (Dest)
       {
         case h1:
           Pos->Flags &= ~PF_WKSCASTLE;
@@ -335,29 +573,40 @@ int quickMakeMove(position *Pos, move Move)
   }
 
   /* move piece to new location */
-  Mask = SQMASK(Move.Orig) | SQMASK(Move.Dest);
+  Mask = SQMASK(Orig) | SQMASK(Dest);
   Pos->Occ ^= Mask;
   Pos->OccBy[Mover][0] ^= Mask;
-  Pos->OccBy[Mover][Move.Piece] ^= Mask;
-  Pos->ZKey ^= Z_PLACEMENT[Mover][Move.Piece][Move.Orig];
-  Pos->ZKey ^= Z_PLACEMENT[Mover][Move.Piece][Move.Dest];
+  Pos->OccBy[Mover][Piece] ^= Mask;
+  Pos->ZKey ^= Z_PLACEMENT[Mover][Piece][Orig];
+  Pos->ZKey ^= Z_PLACEMENT[Mover][Piece][Dest];
+  removePcSq(Pos, Mover, Piece, Orig);
+  addPcSq(Pos, Mover, Piece, Dest);
+  if (Piece == PAWN)
+  {
+    Pos->PawnKey ^= Z_PLACEMENT[Mover][PAWN][Orig];
+    Pos->PawnKey ^= Z_PLACEMENT[Mover][PAWN][Dest];
+  }
 
   /* castling */
-  if (Move.Type == MT_CASTLE)
+  if (Type == MT_CASTLE)
   {
-    if (Move.Dest > Move.Orig)
+    if (Dest > Orig)
     {
       Sq = (Mover == WHITE)?h1:h8;
-      Mask = SQMASK(Move.Orig + 8) | SQMASK(Sq);
-      Pos->ZKey ^= Z_PLACEMENT[Mover][ROOK][Move.Orig+8];
+      Mask = SQMASK(Orig + 8) | SQMASK(Sq);
+      Pos->ZKey ^= Z_PLACEMENT[Mover][ROOK][Orig+8];
       Pos->ZKey ^= Z_PLACEMENT[Mover][ROOK][Sq];
+      removePcSq(Pos, Mover, ROOK, Sq);
+      addPcSq(Pos, Mover, ROOK, Orig+8);
     }
     else
     {
       Sq = (Mover == WHITE)?a1:a8;
-      Mask = SQMASK(Move.Orig - 8) | SQMASK(Sq);
-      Pos->ZKey ^= Z_PLACEMENT[Mover][ROOK][Move.Orig-8];
+      Mask = SQMASK(Orig - 8) | SQMASK(Sq);
+      Pos->ZKey ^= Z_PLACEMENT[Mover][ROOK][Orig-8];
       Pos->ZKey ^= Z_PLACEMENT[Mover][ROOK][Sq];
+      removePcSq(Pos, Mover, ROOK, Sq);
+      addPcSq(Pos, Mover, ROOK, Orig-8);
     }
     Pos->Occ ^= Mask;
     Pos->OccBy[Mover][0] ^= Mask;
@@ -365,12 +614,15 @@ int quickMakeMove(position *Pos, move Move)
   }
 
   /* promotion */
-  else if (Move.PromPc != NO_PIECE)
+  else if (PromPc != NO_PIECE)
   {
-    Pos->OccBy[Mover][Move.Piece] ^= SQMASK(Move.Dest);
-    Pos->ZKey ^= Z_PLACEMENT[Mover][Move.Piece][Move.Dest];
-    Pos->OccBy[Mover][Move.PromPc] ^= SQMASK(Move.Dest);
-    Pos->ZKey ^= Z_PLACEMENT[Mover][Move.PromPc][Move.Dest];
+    Pos->OccBy[Mover][Piece] ^= SQMASK(Dest);
+    Pos->ZKey ^= Z_PLACEMENT[Mover][Piece][Dest];
+    Pos->PawnKey ^= Z_PLACEMENT[Mover][PAWN][Dest];
+    Pos->OccBy[Mover][PromPc] ^= SQMASK(Dest);
+    Pos->ZKey ^= Z_PLACEMENT[Mover][PromPc][Dest];
+    removePcSq(Pos, Mover, Piece, Dest);
+    addPcSq(Pos, Mover, PromPc, Dest);
   }
 
   /* en passant square */
@@ -380,9 +632,9 @@ int quickMakeMove(position *Pos, move Move)
     Pos->EPSquare = NO_SQUARE;
     Pos->Flags &= ~PF_EPLEGAL;
   }
-  if (Move.Type == MT_ADVANCE2)
+  if (Type == MT_ADVANCE2)
   {
-    Pos->EPSquare = (Move.Orig + Move.Dest)/2;
+    Pos->EPSquare = (Orig + Dest)/2;
     // TODO: determine if there is a capture pawn?
     Pos->Flags |= PF_EPLEGAL;
     Pos->ZKey ^= Z_EPSQ[FILE(Pos->EPSquare)];
@@ -392,7 +644,7 @@ int quickMakeMove(position *Pos, move Move)
   if (Pos->Flags & PF_CASTLEFLAGS)
   {
     Pos->ZKey ^= Z_CASTLE[(Pos->Flags & PF_CASTLEFLAGS) >> 8];
-    switch (Move.Orig)
+    switch (Orig)
     {
       case e1:
         Pos->Flags &= ~PF_WCASTLE;
@@ -419,69 +671,96 @@ int quickMakeMove(position *Pos, move Move)
   }
 
   assert(Pos->ZKey == calcZobrist(Pos));
+  assert(Pos->PawnKey == calcPawnZobrist(Pos));
+  assert(Pos->PcSqScore[MIDGAME] == calcPcSqScore(Pos, MIDGAME));
+  assert(Pos->PcSqScore[ENDGAME] == calcPcSqScore(Pos, ENDGAME));
+  assert(Pos->Phase == calcPhase(Pos));
 
   /* determine if opponent is now in check */
-  // TODO: only consider discovered attacks and attacks by a moved piece
-  //       (including the moved rook in a castling move)
-  if (attacked(Pos, firstSq(Pos->OccBy[!Mover][KING]), Mover))
-    Pos->Flags |= PF_CHECK;
-  else
-    Pos->Flags &= ~PF_CHECK;
-
-  /* determine if move puts mover in check */
-  // TODO: only consider discovered attacks non-king moves
-  if (attacked(Pos, firstSq(Pos->OccBy[Mover][KING]), !Mover))
+  // only direct attacks by the moved piece and sliding attacks (direct, or
+  // discovered through a vacated square) need to be considered
+  Sq = firstSq(Pos->OccBy[!Mover][KING]);
+  NewPc = (PromPc != NO_PIECE)? PromPc : Piece;
+  Pos->Flags &= ~PF_CHECK;
+  if (NewPc == PAWN)
   {
-    Pos->Flags |= PF_INVALID;
-    return -1;
+    if (pawnAttackers(Sq, Mover) & SQMASK(Dest))
+      Pos->Flags |= PF_CHECK;
+  }
+  else if (NewPc == KNIGHT)
+  {
+    if (KNIGHT_ATT[Sq] & SQMASK(Dest))
+      Pos->Flags |= PF_CHECK;
   }
+  if (!(Pos->Flags & PF_CHECK)
+      && (NewPc == BISHOP || NewPc == ROOK || NewPc == QUEEN
+        || Type == MT_CASTLE || LINE[Sq][Orig]
+        || (CaptPc != NO_PIECE && Dest == EPSquare)))
+  {
+    if ((rookAtt(Pos->Occ, Sq)
+          & (Pos->OccBy[Mover][ROOK] | Pos->OccBy[Mover][QUEEN]))
+        || (bishopAtt(Pos->Occ, Sq)
+          & (Pos->OccBy[Mover][BISHOP] | Pos->OccBy[Mover][QUEEN])))
+      Pos->Flags |= PF_CHECK;
+  }
+
+  assert(!(Pos->Flags & PF_CHECK) == !attacked(Pos, Sq, Mover));
+  assert(!attacked(Pos, firstSq(Pos->OccBy[Mover][KING]), !Mover));
 
   return 0;
 }
 
 /******************************************************************************
- * int genHashMove(const position *Pos, hashmove HashMove);
+ * int genHashMove(const position *Pos, const checkinfo *CI,
+ *                 hashmove HashMove);
  * PARAMETERS
  *    Pos - pointer to the position to generate moves for.
+ *    CI - the result of getCheckInfo() for *Pos.
  *    HashMove - a hash move.
  * DESCRIPTION
- *    Expand HashMove and push it to the stack.
+ *    Expand HashMove and push it to the stack if it is legal.
  * RETURN VALUE
  *    Returns the number of moves generated -- zero for failure, one for
  *    success.
  */
-int genHashMove(const position *Pos, hashmove HashMove)
+int genHashMove(const position *Pos, const checkinfo *CI, hashmove HashMove)
 {
   move Move;
 
-  if (expandMove(Pos, HashMove, &Move) != 0) {
+  if (expandMove(Pos, CI, HashMove, &Move) != 0) {
     return 0;
   } else {
-    pushMove(&Move);
+    pushMove(Move);
     return 1;
   }
 }
 
 /******************************************************************************
- * int genCaptures(const position *Pos);
+ * int genCaptures(const position *Pos, const checkinfo *CI);
  * PARAMETERS
  *    Pos - pointer to the position to generate moves for.
+ *    CI - the result of getCheckInfo() for *Pos.
  * DESCRIPTION
- *    Generate promotion and capture moves for the position Pos and push them
- *    to the move stack.
+ *    Generate legal promotion and capture moves for the position Pos and push
+ *    them to the move stack.
  * RETURN VALUE
  *    Returns the number of moves generated.
  */
-int genCaptures(const position *Pos)
+int genCaptures(const position *Pos, const checkinfo *CI)
 {
   static const int PAWN_SHIFT[2] = {7, 9};
   const color Mover = (Pos->Flags & PF_WHITEMOVE)? WHITE : BLACK;
   const int KingSide = Mover; // king-side element of PAWN_SHIFT array
   const bitboard Occ = Pos->Occ;
   const int StackBase = StackTop;
+  const square KingSq = CI->KingSq;
+  const bitboard Pinned = CI->Pinned;
+  const bitboard Evasions = CI->Evasions;
 
   bitboard Targets;
-  move Move;
+  piece Piece = NO_PIECE, CaptPc = NO_PIECE, PromPc = NO_PIECE;
+  square Orig = a1, Dest = a1;
+  movetype Type = MT_STANDARD;
   bitboard Pieces;
   bitboard MvBd;
   bitboard PAttQS, PAttKS;  // for pawn captures toward queen and king sides
@@ -491,19 +770,17 @@ int genCaptures(const position *Pos)
   if (Pos->Flags & PF_INVALID)
     return 0;
 
-  memset(&Move, 0, sizeof(move));
-
   /* pawn attacks */
-  Move.Piece = PAWN;
+  Piece = PAWN;
   Pieces = Pos->OccBy[Mover][PAWN];
   PAttQS = (Pieces >> PAWN_SHIFT[!KingSide]);
   PAttKS = (Pieces << PAWN_SHIFT[KingSide]);
 
   /* capture promotions in MVV/LVA order */
-  Move.PromPc = QUEEN;
-  for (Move.CaptPc = QUEEN; Move.CaptPc > PAWN; Move.CaptPc--)
+  PromPc = QUEEN;
+  for (CaptPc = QUEEN; CaptPc > PAWN; CaptPc--)
   {
-    Targets = PROM_RANKS & Pos->OccBy[!Mover][Move.CaptPc];
+    Targets = PROM_RANKS & Pos->OccBy[!Mover][CaptPc];
     if (!Targets)
       continue;
 
@@ -511,9 +788,12 @@ int genCaptures(const position *Pos)
     MvBd = PAttQS & Targets;
     for (; MvBd; CLEARLSB(MvBd))
     {
-      Move.Dest = firstSq(MvBd);
-      Move.Orig = Move.Dest + PAWN_SHIFT[!KingSide];
-      pushMove(&Move);
+      Dest = firstSq(MvBd);
+      Orig = Dest + PAWN_SHIFT[!KingSide];
+      if (!(legalDests(Pinned, Evasions, KingSq, Orig)
+            & SQMASK(Dest)))
+        continue;
+      pushMove(packMove(Piece, Orig, Dest, CaptPc, PromPc, Type));
       nMoves++;
     }
 
@@ -521,23 +801,29 @@ int genCaptures(const position *Pos)
     MvBd = PAttKS & Targets;
     for (; MvBd; CLEARLSB(MvBd))
     {
-      Move.Dest = firstSq(MvBd);
-      Move.Orig = Move.Dest - PAWN_SHIFT[KingSide];
-      pushMove(&Move);
+      Dest = firstSq(MvBd);
+      Orig = Dest - PAWN_SHIFT[KingSide];
+      if (!(legalDests(Pinned, Evasions, KingSq, Orig)
+            & SQMASK(Dest)))
+        continue;
+      pushMove(packMove(Piece, Orig, Dest, CaptPc, PromPc, Type));
       nMoves++;
     }
   }
 
   /* non-capture promotions */
-  Move.CaptPc = NO_PIECE;
+  CaptPc = NO_PIECE;
   if (Mover == WHITE)
   {
     MvBd = (Pieces << 1) & PROM_RANKS & ~Occ;
     for (; MvBd; CLEARLSB(MvBd))
     {
-      Move.Dest = firstSq(MvBd);
-      Move.Orig = Move.Dest - 1;
-      pushMove(&Move);
+      Dest = firstSq(MvBd);
+      Orig = Dest - 1;
+      if (!(legalDests(Pinned, Evasions, KingSq, Orig)
+            & SQMASK(Dest)))
+        continue;
+      pushMove(packMove(Piece, Orig, Dest, CaptPc, PromPc, Type));
       nMoves++;
     }
   }
@@ -546,18 +832,21 @@ int genCaptures(const position *Pos)
     MvBd = (Pieces >> 1) & PROM_RANKS & ~Occ;
     for (; MvBd; CLEARLSB(MvBd))
     {
-      Move.Dest = firstSq(MvBd);
-      Move.Orig = Move.Dest + 1;
-      pushMove(&Move);
+      Dest = firstSq(MvBd);
+      Orig = Dest + 1;
+      if (!(legalDests(Pinned, Evasions, KingSq, Orig)
+            & SQMASK(Dest)))
+        continue;
+      pushMove(packMove(Piece, Orig, Dest, CaptPc, PromPc, Type));
       nMoves++;
     }
   }
 
   /* non-promotion captures in MVV/LVA order */
-  Move.PromPc = NO_PIECE;
-  for (Move.CaptPc = QUEEN; Move.CaptPc > NO_PIECE; Move.CaptPc--)
+  PromPc = NO_PIECE;
+  for (CaptPc = QUEEN; CaptPc > NO_PIECE; CaptPc--)
   {
-    Targets = Pos->OccBy[!Mover][Move.CaptPc];
+    Targets = Pos->OccBy[!Mover][CaptPc];
     if (!Targets)
       continue;
 
@@ -566,10 +855,13 @@ int genCaptures(const position *Pos)
     MvBd = PAttQS & ~PROM_RANKS & Targets;
     for (; MvBd; CLEARLSB(MvBd))
     {
-      Move.Piece = PAWN;
-      Move.Dest = firstSq(MvBd);
-      Move.Orig = Move.Dest + PAWN_SHIFT[!KingSide];
-      pushMove(&Move);
+      Piece = PAWN;
+      Dest = firstSq(MvBd);
+      Orig = Dest + PAWN_SHIFT[!KingSide];
+      if (!(legalDests(Pinned, Evasions, KingSq, Orig)
+            & SQMASK(Dest)))
+        continue;
+      pushMove(packMove(Piece, Orig, Dest, CaptPc, PromPc, Type));
       nMoves++;
     }
   
@@ -577,10 +869,13 @@ int genCaptures(const position *Pos)
     MvBd = PAttKS & ~PROM_RANKS & Targets;
     for (; MvBd; CLEARLSB(MvBd))
     {
-      Move.Piece = PAWN;
-      Move.Dest = firstSq(MvBd);
-      Move.Orig = Move.Dest - PAWN_SHIFT[KingSide];
-      pushMove(&Move);
+      Piece = PAWN;
+      Dest = firstSq(MvBd);
+      Orig = Dest - PAWN_SHIFT[KingSide];
+      if (!(legalDests(Pinned, Evasions, KingSq, Orig)
+            & SQMASK(Dest)))
+        continue;
+      pushMove(packMove(Piece, Orig, Dest, CaptPc, PromPc, Type));
       nMoves++;
     }
   
@@ -588,14 +883,15 @@ int genCaptures(const position *Pos)
     Pieces = Pos->OccBy[Mover][KNIGHT];
     if (Pieces)
     {
-      Move.Piece = KNIGHT;
+      Piece = KNIGHT;
       do {
-        Move.Orig = firstSq(Pieces);
-        MvBd = KNIGHT_ATT[Move.Orig] & Targets;
+        Orig = firstSq(Pieces);
+        MvBd = KNIGHT_ATT[Orig] & Targets
+            & legalDests(Pinned, Evasions, KingSq, Orig);
         for (; MvBd; CLEARLSB(MvBd))
         {
-          Move.Dest = firstSq(MvBd);
-          pushMove(&Move);
+          Dest = firstSq(MvBd);
+          pushMove(packMove(Piece, Orig, Dest, CaptPc, PromPc, Type));
           nMoves++;
         }
         CLEARLSB(Pieces);
@@ -606,16 +902,15 @@ int genCaptures(const position *Pos)
     Pieces = Pos->OccBy[Mover][BISHOP];
     if (Pieces)
     {
-      Move.Piece = BISHOP;
+      Piece = BISHOP;
       do {
-        Move.Orig = firstSq(Pieces);
-        MvBd = (diagonalAtt(Occ, Move.Orig)
-            | antidiagAtt(Occ, Move.Orig))
-            & Targets;
+        Orig = firstSq(Pieces);
+        MvBd = bishopAtt(Occ, Orig) & Targets
+            & legalDests(Pinned, Evasions, KingSq, Orig);
         for (; MvBd; CLEARLSB(MvBd))
         {
-          Move.Dest = firstSq(MvBd);
-          pushMove(&Move);
+          Dest = firstSq(MvBd);
+          pushMove(packMove(Piece, Orig, Dest, CaptPc, PromPc, Type));
           nMoves++;
         }
         CLEARLSB(Pieces);
@@ -626,16 +921,15 @@ int genCaptures(const position *Pos)
     Pieces = Pos->OccBy[Mover][ROOK];
     if (Pieces)
     {
-      Move.Piece = ROOK;
+      Piece = ROOK;
       do {
-        Move.Orig = firstSq(Pieces);
-        MvBd = (rankAtt(Occ, Move.Orig)
-            | fileAtt(Occ, Move.Orig))
-            & Targets;
+        Orig = firstSq(Pieces);
+        MvBd = rookAtt(Occ, Orig) & Targets
+            & legalDests(Pinned, Evasions, KingSq, Orig);
         for (; MvBd; CLEARLSB(MvBd))
         {
-          Move.Dest = firstSq(MvBd);
-          pushMove(&Move);
+          Dest = firstSq(MvBd);
+          pushMove(packMove(Piece, Orig, Dest, CaptPc, PromPc, Type));
           nMoves++;
         }
         CLEARLSB(Pieces);
@@ -646,18 +940,15 @@ int genCaptures(const position *Pos)
     Pieces = Pos->OccBy[Mover][QUEEN];
     if (Pieces)
     {
-      Move.Piece = QUEEN;
+      Piece = QUEEN;
       do {
-        Move.Orig = firstSq(Pieces);
-        MvBd = (diagonalAtt(Occ, Move.Orig)
-            | antidiagAtt(Occ, Move.Orig)
-            | rankAtt(Occ, Move.Orig)
-            | fileAtt(Occ, Move.Orig))
-            & Targets;
+        Orig = firstSq(Pieces);
+        MvBd = (bishopAtt(Occ, Orig) | rookAtt(Occ, Orig))
+            & Targets & legalDests(Pinned, Evasions, KingSq, Orig);
         for (; MvBd; CLEARLSB(MvBd))
         {
-          Move.Dest = firstSq(MvBd);
-          pushMove(&Move);
+          Dest = firstSq(MvBd);
+          pushMove(packMove(Piece, Orig, Dest, CaptPc, PromPc, Type));
           nMoves++;
         }
         CLEARLSB(Pieces);
@@ -665,14 +956,16 @@ int genCaptures(const position *Pos)
     }
   
     /* king moves */
-    Move.Piece = KING;
+    Piece = KING;
     // since there is exactly one king per side, we don't need a loop
-    Move.Orig = firstSq(Pos->OccBy[Mover][KING]);
-    MvBd = KING_ATT[Move.Orig] & Targets;
+    Orig = KingSq;
+    MvBd = KING_ATT[Orig] & Targets;
     for (; MvBd; CLEARLSB(MvBd))
     {
-      Move.Dest = firstSq(MvBd);
-      pushMove(&Move);
+      Dest = firstSq(MvBd);
+      if (!kingMoveLegal(Pos, Mover, Orig, Dest))
+        continue;
+      pushMove(packMove(Piece, Orig, Dest, CaptPc, PromPc, Type));
       nMoves++;
     }
   }
@@ -683,36 +976,39 @@ int genCaptures(const position *Pos)
     // toward queen side
     if (PAttQS & SQMASK(Pos->EPSquare))
     {
-      Move.Piece = PAWN;
-      Move.CaptPc = PAWN;
-      Move.Dest = Pos->EPSquare;
-      Move.Orig = Move.Dest + PAWN_SHIFT[!KingSide];
-      pushMove(&Move);
-      nMoves++;
+      Piece = PAWN;
+      CaptPc = PAWN;
+      Dest = Pos->EPSquare;
+      Orig = Dest + PAWN_SHIFT[!KingSide];
+      if (epLegal(Pos, Mover, KingSq, Orig))
+      {
+        pushMove(packMove(Piece, Orig, Dest, CaptPc, PromPc, Type));
+        nMoves++;
+      }
     }
   
     // toward king side
     if (PAttKS & SQMASK(Pos->EPSquare))
     {
-      Move.Piece = PAWN;
-      Move.CaptPc = PAWN;
-      Move.Dest = Pos->EPSquare;
-      Move.Orig = Move.Dest - PAWN_SHIFT[KingSide];
-      pushMove(&Move);
-      nMoves++;
+      Piece = PAWN;
+      CaptPc = PAWN;
+      Dest = Pos->EPSquare;
+      Orig = Dest - PAWN_SHIFT[KingSide];
+      if (epLegal(Pos, Mover, KingSq, Orig))
+      {
+        pushMove(packMove(Piece, Orig, Dest, CaptPc, PromPc, Type));
+        nMoves++;
+      }
     }
   }
 
   /* under promotions */
-  for (i = StackBase; i < StackBase+nMoves && MvStack[i].PromPc == QUEEN; i++)
-  {
-    Move = MvStack[i];
-    Move.PromPc = KNIGHT;
-    pushMove(&Move);
-    Move.PromPc = ROOK;
-    pushMove(&Move);
-    Move.PromPc = BISHOP;
-    pushMove(&Move);
+  for (i = StackBase; i < StackBase+nMoves && getPromPc(MvStack[i]) == QUEEN;
+      i++)
+  {
+    pushMove(setPromPc(MvStack[i], KNIGHT));
+    pushMove(setPromPc(MvStack[i], ROOK));
+    pushMove(setPromPc(MvStack[i], BISHOP));
     nMoves += 3;
   }
 
@@ -720,21 +1016,27 @@ int genCaptures(const position *Pos)
 }
 
 /******************************************************************************
- * int genQuietMoves(const position *Pos);
+ * int genQuietMoves(const position *Pos, const checkinfo *CI);
  * PARAMETERS
  *    Pos - pointer to the position to generate moves for.
+ *    CI - the result of getCheckInfo() for *Pos.
  * DESCRIPTION
- *    Generate quiet (non-promotion, non-capture) moves for the position Pos
- *    and push them to the move stack.
+ *    Generate legal quiet (non-promotion, non-capture) moves for the position
+ *    Pos and push them to the move stack.
  * RETURN VALUE
  *    Returns the number of moves generated.
  */
-int genQuietMoves(const position *Pos)
+int genQuietMoves(const position *Pos, const checkinfo *CI)
 {
   const color Mover = (Pos->Flags & PF_WHITEMOVE)? WHITE : BLACK;
   const bitboard Occ = Pos->Occ;
   const bitboard Targets = ~Occ;
-  move Move;
+  const square KingSq = CI->KingSq;
+  const bitboard Pinned = CI->Pinned;
+  const bitboard Evasions = CI->Evasions;
+  piece Piece = NO_PIECE, CaptPc = NO_PIECE, PromPc = NO_PIECE;
+  square Orig = a1, Dest = a1;
+  movetype Type = MT_STANDARD;
   int nMoves = 0;
   bitboard Pieces;
   bitboard MvBd, MvBd2;
@@ -742,34 +1044,32 @@ int genQuietMoves(const position *Pos)
   if (Pos->Flags & PF_INVALID)
     return 0;
 
-  memset(&Move, 0, sizeof(move));
-
   /* castling */
   if (Mover == WHITE && (Pos->Flags & PF_WCASTLE)
       && !(Pos->Flags & PF_CHECK))
   {
     Pieces = rankAtt(Occ, e1) & Pos->OccBy[Mover][ROOK];
     if ((Pieces & SQMASK(h1)) && (Pos->Flags & PF_WKSCASTLE)
-        && !attacked(Pos, f1, !Mover))
+        && !attacked(Pos, f1, !Mover) && !attacked(Pos, g1, !Mover))
     {
-      Move.Type = MT_CASTLE;
-      Move.Piece = KING;
-      Move.Orig = e1;
-      Move.Dest = g1;
-      pushMove(&Move);
+      Type = MT_CASTLE;
+      Piece = KING;
+      Orig = e1;
+      Dest = g1;
+      pushMove(packMove(Piece, Orig, Dest, CaptPc, PromPc, Type));
       nMoves++;
-      Move.Type = MT_STANDARD;
+      Type = MT_STANDARD;
     }
     if ((Pieces & SQMASK(a1)) && (Pos->Flags & PF_WQSCASTLE)
-        && !attacked(Pos, d1, !Mover))
+        && !attacked(Pos, d1, !Mover) && !attacked(Pos, c1, !Mover))
     {
-      Move.Type = MT_CASTLE;
-      Move.Piece = KING;
-      Move.Orig = e1;
-      Move.Dest = c1;
-      pushMove(&Move);
+      Type = MT_CASTLE;
+      Piece = KING;
+      Orig = e1;
+      Dest = c1;
+      pushMove(packMove(Piece, Orig, Dest, CaptPc, PromPc, Type));
       nMoves++;
-      Move.Type = MT_STANDARD;
+      Type = MT_STANDARD;
     }
   }
   else if (Mover == BLACK && (Pos->Flags & PF_BCASTLE)
@@ -777,26 +1077,26 @@ int genQuietMoves(const position *Pos)
   {
     Pieces = rankAtt(Occ, e8) & Pos->OccBy[Mover][ROOK];
     if ((Pieces & SQMASK(h8)) && (Pos->Flags & PF_BKSCASTLE)
-        && !attacked(Pos, f8, !Mover))
+        && !attacked(Pos, f8, !Mover) && !attacked(Pos, g8, !Mover))
     {
-      Move.Type = MT_CASTLE;
-      Move.Piece = KING;
-      Move.Orig = e8;
-      Move.Dest = g8;
-      pushMove(&Move);
+      Type = MT_CASTLE;
+      Piece = KING;
+      Orig = e8;
+      Dest = g8;
+      pushMove(packMove(Piece, Orig, Dest, CaptPc, PromPc, Type));
       nMoves++;
-      Move.Type = MT_STANDARD;
+      Type = MT_STANDARD;
     }
     if ((Pieces & SQMASK(a8)) && (Pos->Flags & PF_BQSCASTLE)
-        && !attacked(Pos, d8, !Mover))
+        && !attacked(Pos, d8, !Mover) && !attacked(Pos, c8, !Mover))
     {
-      Move.Type = MT_CASTLE;
-      Move.Piece = KING;
-      Move.Orig = e8;
-      Move.Dest = c8;
-      pushMove(&Move);
+      Type = MT_CASTLE;
+      Piece = KING;
+      Orig = e8;
+      Dest = c8;
+      pushMove(packMove(Piece, Orig, Dest, CaptPc, PromPc, Type));
       nMoves++;
-      Move.Type = MT_STANDARD;
+      Type = MT_STANDARD;
     }
   }
 
@@ -804,8 +1104,8 @@ int genQuietMoves(const position *Pos)
   Pieces = Pos->OccBy[Mover][PAWN];
   if (Pieces)
   {
-    Move.Piece = PAWN;
-    Move.Type = MT_ADVANCE2;
+    Piece = PAWN;
+    Type = MT_ADVANCE2;
 
     if (Mover == WHITE)
     {
@@ -815,19 +1115,25 @@ int genQuietMoves(const position *Pos)
       // two-square advances
       for (; MvBd2; CLEARLSB(MvBd2))
       {
-        Move.Dest = firstSq(MvBd2);
-        Move.Orig = Move.Dest - 2;
-        pushMove(&Move);
+        Dest = firstSq(MvBd2);
+        Orig = Dest - 2;
+        if (!(legalDests(Pinned, Evasions, KingSq, Orig)
+              & SQMASK(Dest)))
+          continue;
+        pushMove(packMove(Piece, Orig, Dest, CaptPc, PromPc, Type));
         nMoves++;
       }
 
       // one-square advances
-      Move.Type = MT_STANDARD;
+      Type = MT_STANDARD;
       for (; MvBd; CLEARLSB(MvBd))
       {
-        Move.Dest = firstSq(MvBd);
-        Move.Orig = Move.Dest - 1;
-        pushMove(&Move);
+        Dest = firstSq(MvBd);
+        Orig = Dest - 1;
+        if (!(legalDests(Pinned, Evasions, KingSq, Orig)
+              & SQMASK(Dest)))
+          continue;
+        pushMove(packMove(Piece, Orig, Dest, CaptPc, PromPc, Type));
         nMoves++;
       }
     }
@@ -839,19 +1145,25 @@ int genQuietMoves(const position *Pos)
       // one-square advances
       for (; MvBd2; CLEARLSB(MvBd2))
       {
-        Move.Dest = firstSq(MvBd2);
-        Move.Orig = Move.Dest + 2;
-        pushMove(&Move);
+        Dest = firstSq(MvBd2);
+        Orig = Dest + 2;
+        if (!(legalDests(Pinned, Evasions, KingSq, Orig)
+              & SQMASK(Dest)))
+          continue;
+        pushMove(packMove(Piece, Orig, Dest, CaptPc, PromPc, Type));
         nMoves++;
       }
 
       // two-square advances
-      Move.Type = MT_STANDARD;
+      Type = MT_STANDARD;
       for (; MvBd; CLEARLSB(MvBd))
       {
-        Move.Dest = firstSq(MvBd);
-        Move.Orig = Move.Dest + 1;
-        pushMove(&Move);
+        Dest = firstSq(MvBd);
+        Orig = Dest + 1;
+        if (!(legalDests(Pinned, Evasions, KingSq, Orig)
+              & SQMASK(Dest)))
+          continue;
+        pushMove(packMove(Piece, Orig, Dest, CaptPc, PromPc, Type));
         nMoves++;
       }
     }
@@ -861,14 +1173,15 @@ int genQuietMoves(const position *Pos)
   Pieces = Pos->OccBy[Mover][KNIGHT];
   if (Pieces)
   {
-    Move.Piece = KNIGHT;
+    Piece = KNIGHT;
     do {
-      Move.Orig = firstSq(Pieces);
-      MvBd = KNIGHT_ATT[Move.Orig] & Targets;
+      Orig = firstSq(Pieces);
+      MvBd = KNIGHT_ATT[Orig] & Targets
+          & legalDests(Pinned, Evasions, KingSq, Orig);
       for (; MvBd; CLEARLSB(MvBd))
       {
-        Move.Dest = firstSq(MvBd);
-        pushMove(&Move);
+        Dest = firstSq(MvBd);
+        pushMove(packMove(Piece, Orig, Dest, CaptPc, PromPc, Type));
         nMoves++;
       }
       CLEARLSB(Pieces);
@@ -879,16 +1192,15 @@ int genQuietMoves(const position *Pos)
   Pieces = Pos->OccBy[Mover][BISHOP];
   if (Pieces)
   {
-    Move.Piece = BISHOP;
+    Piece = BISHOP;
     do {
-      Move.Orig = firstSq(Pieces);
-      MvBd = (diagonalAtt(Occ, Move.Orig)
-          | antidiagAtt(Occ, Move.Orig))
-          & Targets;
+      Orig = firstSq(Pieces);
+      MvBd = bishopAtt(Occ, Orig) & Targets
+          & legalDests(Pinned, Evasions, KingSq, Orig);
       for (; MvBd; CLEARLSB(MvBd))
       {
-        Move.Dest = firstSq(MvBd);
-        pushMove(&Move);
+        Dest = firstSq(MvBd);
+        pushMove(packMove(Piece, Orig, Dest, CaptPc, PromPc, Type));
         nMoves++;
       }
       CLEARLSB(Pieces);
@@ -899,16 +1211,15 @@ int genQuietMoves(const position *Pos)
   Pieces = Pos->OccBy[Mover][ROOK];
   if (Pieces)
   {
-    Move.Piece = ROOK;
+    Piece = ROOK;
     do {
-      Move.Orig = firstSq(Pieces);
-      MvBd = (rankAtt(Occ, Move.Orig)
-          | fileAtt(Occ, Move.Orig))
-          & Targets;
+      Orig = firstSq(Pieces);
+      MvBd = rookAtt(Occ, Orig) & Targets
+          & legalDests(Pinned, Evasions, KingSq, Orig);
       for (; MvBd; CLEARLSB(MvBd))
       {
-        Move.Dest = firstSq(MvBd);
-        pushMove(&Move);
+        Dest = firstSq(MvBd);
+        pushMove(packMove(Piece, Orig, Dest, CaptPc, PromPc, Type));
         nMoves++;
       }
       CLEARLSB(Pieces);
@@ -919,18 +1230,15 @@ int genQuietMoves(const position *Pos)
   Pieces = Pos->OccBy[Mover][QUEEN];
   if (Pieces)
   {
-    Move.Piece = QUEEN;
+    Piece = QUEEN;
     do {
-      Move.Orig = firstSq(Pieces);
-      MvBd = (diagonalAtt(Occ, Move.Orig)
-          | antidiagAtt(Occ, Move.Orig)
-          | rankAtt(Occ, Move.Orig)
-          | fileAtt(Occ, Move.Orig))
-          & Targets;
+      Orig = firstSq(Pieces);
+      MvBd = (bishopAtt(Occ, Orig) | rookAtt(Occ, Orig))
+          & Targets & legalDests(Pinned, Evasions, KingSq, Orig);
       for (; MvBd; CLEARLSB(MvBd))
       {
-        Move.Dest = firstSq(MvBd);
-        pushMove(&Move);
+        Dest = firstSq(MvBd);
+        pushMove(packMove(Piece, Orig, Dest, CaptPc, PromPc, Type));
         nMoves++;
       }
       CLEARLSB(Pieces);
@@ -938,18 +1246,302 @@ int genQuietMoves(const position *Pos)
   }
 
   /* king moves */
-  Move.Piece = KING;
+  Piece = KING;
   // since there is exactly one king per side, we don't need a loop
-  Move.Orig = firstSq(Pos->OccBy[Mover][KING]);
-  MvBd = KING_ATT[Move.Orig] & Targets;
+  Orig = KingSq;
+  MvBd = KING_ATT[Orig] & Targets;
   for (; MvBd; CLEARLSB(MvBd))
   {
-    Move.Dest = firstSq(MvBd);
-    pushMove(&Move);
+    Dest = firstSq(MvBd);
+    if (!kingMoveLegal(Pos, Mover, Orig, Dest))
+      continue;
+    pushMove(packMove(Piece, Orig, Dest, CaptPc, PromPc, Type));
     nMoves++;
   }
 
   return nMoves;
 }
 
+/******************************************************************************
+ * int pushEvasion(move Move);
+ * PARAMETERS
+ *    Move - the move to push, promoting to a QUEEN for promotions.
+ * DESCRIPTION
+ *    Pushes Move to the move stack, followed by the under-promotions if it is
+ *    a promotion.
+ * RETURN VALUE
+ *    Returns the number of moves pushed.
+ */
+static inline int pushEvasion(move Move)
+{
+  pushMove(Move);
+  if (getPromPc(Move) == NO_PIECE)
+    return 1;
+
+  pushMove(setPromPc(Move, KNIGHT));
+  pushMove(setPromPc(Move, ROOK));
+  pushMove(setPromPc(Move, BISHOP));
+  return 4;
+}
+
+/******************************************************************************
+ * int genCheckEvasions(const position *Pos);
+ * PARAMETERS
+ *    Pos - pointer to the position to generate moves for.
+ * DESCRIPTION
+ *    Generate moves for getting out of check for the position Pos and push
+ *    them to the move stack. Captures of the checking piece come first, then
+ *    king moves, then interpositions. The mover must be in check.
+ * RETURN VALUE
+ *    Returns the number of moves generated.
+ */
+int genCheckEvasions(const position *Pos)
+{
+  const color Mover = (Pos->Flags & PF_WHITEMOVE)? WHITE : BLACK;
+  const bitboard *const Own = Pos->OccBy[Mover];
+  const bitboard Occ = Pos->Occ;
+  const square KingSq = firstSq(Own[KING]);
+  const bitboard Checkers = attackersOf(Pos, KingSq, !Mover, Occ);
+  const square CheckSq = firstSq(Checkers);
+  const int Forward = (Mover == WHITE)? 1 : -1;
+  bitboard Pinned;
+  bitboard Pieces;
+  bitboard Blocks;
+  piece Piece, CaptPc, PromPc;
+  square Orig, Dest;
+  int nMoves = 0;
+
+  if (Pos->Flags & PF_INVALID)
+    return 0;
+  assert(Checkers);
+
+  // in single check, a pinned piece can never capture or block the checker
+  // since it has to stay on a different line to the king
+  if (!(Checkers & (Checkers - 1)))
+  {
+    Pinned = pinnedPieces(Pos, Mover, KingSq);
+
+    /* captures of the checking piece */
+    CaptPc = pieceOn(Pos, !Mover, CheckSq);
+    Pieces = attackersOf(Pos, CheckSq, Mover, Occ) & ~Own[KING] & ~Pinned;
+    for (; Pieces; CLEARLSB(Pieces))
+    {
+      Orig = firstSq(Pieces);
+      Piece = pieceOn(Pos, Mover, Orig);
+      PromPc = (Piece == PAWN && TESTSQ(PROM_RANKS, CheckSq))?
+          QUEEN : NO_PIECE;
+      nMoves += pushEvasion(packMove(Piece, Orig, CheckSq, CaptPc, PromPc,
+          MT_STANDARD));
+    }
+
+    // en passant can take a checking pawn that just advanced two squares, or
+    // block a check discovered by that advance
+    if ((Pos->Flags & PF_EPLEGAL) && Pos->EPSquare != NO_SQUARE
+        && (Pos->EPSquare == CheckSq + Forward
+          || TESTSQ(BETWEEN[KingSq][CheckSq], Pos->EPSquare)))
+    {
+      Dest = Pos->EPSquare;
+      Pieces = pawnAttackers(Dest, Mover) & Own[PAWN] & ~Pinned;
+      for (; Pieces; CLEARLSB(Pieces))
+      {
+        Orig = firstSq(Pieces);
+        if (epLegal(Pos, Mover, KingSq, Orig))
+          nMoves += pushEvasion(packMove(PAWN, Orig, Dest, PAWN, NO_PIECE,
+              MT_STANDARD));
+      }
+    }
+  }
+
+  /* king moves */
+  Pieces = KING_ATT[KingSq] & ~Own[0];
+  for (; Pieces; CLEARLSB(Pieces))
+  {
+    Dest = firstSq(Pieces);
+    if (kingMoveLegal(Pos, Mover, KingSq, Dest))
+      nMoves += pushEvasion(packMove(KING, KingSq, Dest,
+          pieceOn(Pos, !Mover, Dest), NO_PIECE, MT_STANDARD));
+  }
+
+  if (Checkers & (Checkers - 1))
+    return nMoves; // double check, only the king can move
+
+  /* interpositions */
+  Blocks = BETWEEN[KingSq][CheckSq];
+  for (; Blocks; CLEARLSB(Blocks))
+  {
+    Dest = firstSq(Blocks);
+
+    // pieces other than pawns
+    Pieces = ((KNIGHT_ATT[Dest] & Own[KNIGHT])
+        | (bishopAtt(Occ, Dest) & (Own[BISHOP] | Own[QUEEN]))
+        | (rookAtt(Occ, Dest) & (Own[ROOK] | Own[QUEEN])))
+        & ~Pinned;
+    for (; Pieces; CLEARLSB(Pieces))
+    {
+      Orig = firstSq(Pieces);
+      nMoves += pushEvasion(packMove(pieceOn(Pos, Mover, Orig), Orig, Dest,
+          NO_PIECE, NO_PIECE, MT_STANDARD));
+    }
+
+    // pawn advances
+    Orig = Dest - Forward;
+    if (TESTSQ(Own[PAWN] & ~Pinned, Orig))
+    {
+      PromPc = TESTSQ(PROM_RANKS, Dest)? QUEEN : NO_PIECE;
+      nMoves += pushEvasion(packMove(PAWN, Orig, Dest, NO_PIECE, PromPc,
+          MT_STANDARD));
+    }
+    else if (RANK(Dest) == ((Mover == WHITE)? R_4 : R_5)
+        && !TESTSQ(Occ, Orig)
+        && TESTSQ(Own[PAWN] & ~Pinned, Orig - Forward))
+    {
+      nMoves += pushEvasion(packMove(PAWN, Orig - Forward, Dest, NO_PIECE,
+          NO_PIECE, MT_ADVANCE2));
+    }
+  }
+
+  return nMoves;
+}
+
+/******************************************************************************
+ * int countPawnMoves(bitboard Pawns, bitboard Dests, color Mover,
+ *                    bitboard Empty, bitboard Enemy);
+ * PARAMETERS
+ *    Pawns - the pawns to count moves for.
+ *    Dests - squares the pawns may legally move to.
+ *    Mover - the color of the pawns.
+ *    Empty - the empty squares.
+ *    Enemy - the squares of the pieces that may be captured.
+ * DESCRIPTION
+ *    Counts the advances and captures (not en passant) of Pawns that end on
+ *    Dests, with a promotion counting as four moves.
+ * RETURN VALUE
+ *    Returns the number of moves.
+ */
+static inline int countPawnMoves(bitboard Pawns, bitboard Dests, color Mover,
+    bitboard Empty, bitboard Enemy)
+{
+  bitboard Push1, Push2, CaptQS, CaptKS;
+
+  if (Mover == WHITE)
+  {
+    Push1 = (Pawns << 1) & Empty;
+    Push2 = ((Push1 & RANKMASK(R_3)) << 1) & Empty;
+    CaptQS = (Pawns >> 7) & Enemy;
+    CaptKS = (Pawns << 9) & Enemy;
+  }
+  else
+  {
+    Push1 = (Pawns >> 1) & Empty;
+    Push2 = ((Push1 & RANKMASK(R_6)) >> 1) & Empty;
+    CaptQS = (Pawns >> 9) & Enemy;
+    CaptKS = (Pawns << 7) & Enemy;
+  }
+  Push1 &= Dests;
+  CaptQS &= Dests;
+  CaptKS &= Dests;
+
+  return popCnt(Push1 & ~PROM_RANKS) + 4*popCnt(Push1 & PROM_RANKS)
+      + popCnt(Push2 & Dests)
+      + popCnt(CaptQS & ~PROM_RANKS) + 4*popCnt(CaptQS & PROM_RANKS)
+      + popCnt(CaptKS & ~PROM_RANKS) + 4*popCnt(CaptKS & PROM_RANKS);
+}
+
+/******************************************************************************
+ * int countMoves(const position *Pos);
+ * PARAMETERS
+ *    Pos - pointer to the position to count moves for.
+ * DESCRIPTION
+ *    Counts the legal moves in the position Pos without generating them.
+ * RETURN VALUE
+ *    Returns the number of legal moves.
+ */
+int countMoves(const position *Pos)
+{
+  const color Mover = (Pos->Flags & PF_WHITEMOVE)? WHITE : BLACK;
+  const bitboard *const Own = Pos->OccBy[Mover];
+  const bitboard Occ = Pos->Occ;
+  const bitboard Targets = ~Own[0];
+  const square KingSq = firstSq(Own[KING]);
+  const int StackBase = StackTop;
+  bitboard Pinned;
+  bitboard Pieces;
+  bitboard MvBd;
+  square Orig;
+  int nMoves = 0;
+
+  if (Pos->Flags & PF_INVALID)
+    return 0;
+
+  // check evasions are comparatively rare, so just generate them
+  if (Pos->Flags & PF_CHECK)
+  {
+    nMoves = genCheckEvasions(Pos);
+    popMoveStack(StackBase);
+    return nMoves;
+  }
+
+  Pinned = pinnedPieces(Pos, Mover, KingSq);
+
+  /* pawn moves */
+  nMoves += countPawnMoves(Own[PAWN] & ~Pinned, ~(bitboard)0, Mover, ~Occ,
+      Pos->OccBy[!Mover][0]);
+  for (Pieces = Own[PAWN] & Pinned; Pieces; CLEARLSB(Pieces))
+  {
+    Orig = firstSq(Pieces);
+    nMoves += countPawnMoves(SQMASK(Orig), LINE[KingSq][Orig], Mover, ~Occ,
+        Pos->OccBy[!Mover][0]);
+  }
+  if ((Pos->Flags & PF_EPLEGAL) && Pos->EPSquare != NO_SQUARE)
+  {
+    Pieces = pawnAttackers(Pos->EPSquare, Mover) & Own[PAWN];
+    for (; Pieces; CLEARLSB(Pieces))
+      nMoves += epLegal(Pos, Mover, KingSq, firstSq(Pieces))? 1 : 0;
+  }
+
+  /* knight moves (a pinned knight can never move) */
+  for (Pieces = Own[KNIGHT] & ~Pinned; Pieces; CLEARLSB(Pieces))
+    nMoves += popCnt(KNIGHT_ATT[firstSq(Pieces)] & Targets);
+
+  /* bishop, rook and queen moves */
+  for (Pieces = Own[BISHOP] | Own[QUEEN]; Pieces; CLEARLSB(Pieces))
+  {
+    Orig = firstSq(Pieces);
+    MvBd = bishopAtt(Occ, Orig) & Targets;
+    if (TESTSQ(Pinned, Orig))
+      MvBd &= LINE[KingSq][Orig];
+    nMoves += popCnt(MvBd);
+  }
+  for (Pieces = Own[ROOK] | Own[QUEEN]; Pieces; CLEARLSB(Pieces))
+  {
+    Orig = firstSq(Pieces);
+    MvBd = rookAtt(Occ, Orig) & Targets;
+    if (TESTSQ(Pinned, Orig))
+      MvBd &= LINE[KingSq][Orig];
+    nMoves += popCnt(MvBd);
+  }
+
+  /* king moves */
+  for (MvBd = KING_ATT[KingSq] & Targets; MvBd; CLEARLSB(MvBd))
+    nMoves += kingMoveLegal(Pos, Mover, KingSq, firstSq(MvBd))? 1 : 0;
+
+  /* castling */
+  if (Pos->Flags & ((Mover == WHITE)? PF_WCASTLE : PF_BCASTLE))
+  {
+    const square KSq = (Mover == WHITE)? e1 : e8;
+    const bitboard Rooks = rankAtt(Occ, KSq) & Own[ROOK];
+
+    if ((Pos->Flags & ((Mover == WHITE)? PF_WKSCASTLE : PF_BKSCASTLE))
+        && TESTSQ(Rooks, KSq + 3*8)
+        && !attacked(Pos, KSq + 8, !Mover) && !attacked(Pos, KSq + 2*8, !Mover))
+      nMoves++;
+    if ((Pos->Flags & ((Mover == WHITE)? PF_WQSCASTLE : PF_BQSCASTLE))
+        && TESTSQ(Rooks, KSq - 4*8)
+        && !attacked(Pos, KSq - 8, !Mover) && !attacked(Pos, KSq - 2*8, !Mover))
+      nMoves++;
+  }
+
+  return nMoves;
+}
+
 /* end of file */
@@ -13,22 +13,27 @@
 #include "vapor.h"
 #include "chess.h"
 
-extern const move *MoveStack;
+// each thread has its own move stack
+extern THREAD_LOCAL const move *MoveStack;
 void resetMoveStack(void);
+void freeMoveStack(void);
 int getMoveStackTop(void);
 int popMoveStack(int NewTop);
 
 extern const bitboard PROM_RANKS;
 
-static inline hashmove getHashMove(const move *Move)
+/* what the generators need to know about pins and checks, found once per
+   node by getCheckInfo() */
+typedef struct checkinfo
 {
-  if (Move->Orig != NO_SQUARE && Move->Dest != NO_SQUARE)
-    return (Move->Orig << 9) | (Move->Dest << 3) | Move->PromPc;
-  else
-    return 0;
-}
+  square KingSq;      // the mover's king
+  bitboard Pinned;    // the mover's pieces pinned to its king
+  bitboard Evasions;  // squares that answer a check, or every square
+} checkinfo;
 
-int expandMove(const position *Pos, hashmove HashMove, move *Move);
+void getCheckInfo(const position *Pos, checkinfo *CI);
+int expandMove(const position *Pos, const checkinfo *CI, hashmove HashMove,
+    move *Move);
 
 /******************************************************************************
  * int quickMakeMove(position *Pos, move Move);
@@ -36,79 +41,244 @@ int expandMove(const position *Pos, hashmove HashMove, move *Move);
  *    Pos - pointer to the position structure on which the move is made.
  *    Move - the move and any additional data.
  * DESCRIPTION
- *    Makes Move on the board pointed to by Pos. Move must be a valid pseudo-
- *    legal move. A move is considered pseudo-legal if it is legal or would be
- *    legal if it did not leave the mover in check. If a move is not full legal
- *    it is still made and the resulting position has the PF_INVALID flag set.
+ *    Makes Move on the board pointed to by Pos. Move must be a legal move.
  * RETURN VALUE
  *    Returns zero on success, -1 on failure.
  * !!!CAUTION!!!
- *    The only legality check is to ensure the move does not leave the mover in
- *    check. Results with non-pseudo-legal moves are undefined and could crash
- *    the program. Therefore, only moves returned by the move generation and
- *    verification functions should be passed to this function.
+ *    No legality checks are made. Results with illegal moves are undefined
+ *    and could crash the program. Therefore, only moves returned by the move
+ *    generation and verification functions should be passed to this function.
  */
 int quickMakeMove(position *Pos, move Move);
 
 /******************************************************************************
- * int genHashMove(const position *Pos, hashmove HashMove);
+ * int makeMove(position *Pos, move Move, undo *Undo);
+ * PARAMETERS
+ *    Pos - pointer to the position structure on which the move is made.
+ *    Move - the move and any additional data.
+ *    Undo - receives the data needed by unmakeMove to take back Move.
+ * DESCRIPTION
+ *    Makes Move on the board pointed to by Pos like quickMakeMove, but saves
+ *    enough information in *Undo to restore the position afterward.
+ * RETURN VALUE
+ *    Returns zero on success, -1 on failure. unmakeMove must only be called
+ *    after success.
+ */
+static inline int makeMove(position *Pos, move Move, undo *Undo)
+{
+  Undo->ZKey = Pos->ZKey;
+  Undo->PawnKey = Pos->PawnKey;
+  Undo->Flags = Pos->Flags;
+  Undo->EPSquare = Pos->EPSquare;
+  Undo->DrawPlies = Pos->DrawPlies;
+  Undo->PcSqScore[MIDGAME] = Pos->PcSqScore[MIDGAME];
+  Undo->PcSqScore[ENDGAME] = Pos->PcSqScore[ENDGAME];
+  Undo->Phase = Pos->Phase;
+  return quickMakeMove(Pos, Move);
+}
+
+/******************************************************************************
+ * void unmakeMove(position *Pos, move Move, const undo *Undo);
+ * PARAMETERS
+ *    Pos - pointer to the position structure on which the move was made.
+ *    Move - the move that was made.
+ *    Undo - the data saved by makeMove when Move was made.
+ * DESCRIPTION
+ *    Takes back Move, restoring the position exactly as it was before
+ *    makeMove was called. Only the piece placement has to be recomputed; the
+ *    key and the rest of the state come from *Undo.
+ */
+static inline void unmakeMove(position *Pos, move Move, const undo *Undo)
+{
+  const color Mover = (Undo->Flags & PF_WHITEMOVE)? WHITE : BLACK;
+  const piece Piece = getPiece(Move);
+  const piece CaptPc = getCaptPc(Move);
+  const piece PromPc = getPromPc(Move);
+  const square Orig = getOrig(Move);
+  const square Dest = getDest(Move);
+  register bitboard Mask;
+
+  /* move piece back to its old location */
+  Mask = SQMASK(Orig) | SQMASK(Dest);
+  Pos->Occ ^= Mask;
+  Pos->OccBy[Mover][0] ^= Mask;
+  if (PromPc == NO_PIECE)
+    Pos->OccBy[Mover][Piece] ^= Mask;
+  else
+  {
+    Pos->OccBy[Mover][Piece] ^= SQMASK(Orig);
+    Pos->OccBy[Mover][PromPc] ^= SQMASK(Dest);
+  }
+
+  /* castling */
+  if (getMoveType(Move) == MT_CASTLE)
+  {
+    if (Dest > Orig)
+      Mask = SQMASK(Orig + 8) | SQMASK((Mover == WHITE)?h1:h8);
+    else
+      Mask = SQMASK(Orig - 8) | SQMASK((Mover == WHITE)?a1:a8);
+    Pos->Occ ^= Mask;
+    Pos->OccBy[Mover][0] ^= Mask;
+    Pos->OccBy[Mover][ROOK] ^= Mask;
+  }
+
+  /* restore captured piece if any */
+  if (CaptPc != NO_PIECE)
+  {
+    if (Dest != Undo->EPSquare)
+      Mask = SQMASK(Dest);
+    else // en passant
+      Mask = SQMASK(SQUARE(FILE(Dest), RANK(Orig)));
+    Pos->Occ |= Mask;
+    Pos->OccBy[!Mover][0] |= Mask;
+    Pos->OccBy[!Mover][CaptPc] |= Mask;
+  }
+
+  /* everything else */
+  if (Mover == BLACK)
+    Pos->MoveNum--;
+  Pos->ZKey = Undo->ZKey;
+  Pos->PawnKey = Undo->PawnKey;
+  Pos->Flags = Undo->Flags;
+  Pos->EPSquare = Undo->EPSquare;
+  Pos->DrawPlies = Undo->DrawPlies;
+  Pos->PcSqScore[MIDGAME] = Undo->PcSqScore[MIDGAME];
+  Pos->PcSqScore[ENDGAME] = Undo->PcSqScore[ENDGAME];
+  Pos->Phase = Undo->Phase;
+}
+
+/******************************************************************************
+ * int genHashMove(const position *Pos, const checkinfo *CI,
+ *                 hashmove HashMove);
  * PARAMETERS
  *    Pos - pointer to the position to generate moves for.
+ *    CI - the result of getCheckInfo() for *Pos.
  *    HashMove - a hash move.
  * DESCRIPTION
- *    Expand HashMove and push it to the stack.
+ *    Expand HashMove and push it to the stack if it is legal.
  * RETURN VALUE
  *    Returns the number of moves generated -- zero for failure, one for
  *    success.
  */
-int genHashMove(const position *Pos, hashmove HashMove);
+int genHashMove(const position *Pos, const checkinfo *CI, hashmove HashMove);
 
 /******************************************************************************
- * int genCaptures(const position *Pos);
+ * int genCaptures(const position *Pos, const checkinfo *CI);
  * PARAMETERS
  *    Pos - pointer to the position to generate moves for.
+ *    CI - the result of getCheckInfo() for *Pos.
  * DESCRIPTION
- *    Generate promotion and capture moves for the position Pos and push them
- *    to the move stack.
+ *    Generate legal promotion and capture moves for the position Pos and push
+ *    them to the move stack.
  * RETURN VALUE
  *    Returns the number of moves generated.
  */
-int genCaptures(const position *Pos);
+int genCaptures(const position *Pos, const checkinfo *CI);
 
 /******************************************************************************
- * int genQuietMoves(const position *Pos);
+ * int genQuietMoves(const position *Pos, const checkinfo *CI);
  * PARAMETERS
  *    Pos - pointer to the position to generate moves for.
+ *    CI - the result of getCheckInfo() for *Pos.
  * DESCRIPTION
- *    Generate quiet (non-promotion, non-capture) moves for the position Pos
- *    and push them to the move stack.
+ *    Generate legal quiet (non-promotion, non-capture) moves for the position
+ *    Pos and push them to the move stack.
  * RETURN VALUE
  *    Returns the number of moves generated.
  */
-int genQuietMoves(const position *Pos);
+int genQuietMoves(const position *Pos, const checkinfo *CI);
 
 /******************************************************************************
  * int genCheckEvasions(const position *Pos);
  * PARAMETERS
  *    Pos - pointer to the position to generate moves for.
  * DESCRIPTION
- *    Generate moves for getting out of check for the position Pos and push
- *    them to the move stack.
+ *    Generate legal moves for getting out of check for the position Pos and
+ *    push them to the move stack. Captures of the checking piece come first,
+ *    then king moves, then interpositions. The mover must be in check.
  * RETURN VALUE
  *    Returns the number of moves generated.
  */
 int genCheckEvasions(const position *Pos);
 
+/******************************************************************************
+ * int countMoves(const position *Pos);
+ * PARAMETERS
+ *    Pos - pointer to the position to count moves for.
+ * DESCRIPTION
+ *    Counts the legal moves in the position Pos without generating them, for
+ *    counting the leaves of a perft tree in bulk.
+ * RETURN VALUE
+ *    Returns the number of legal moves.
+ */
+int countMoves(const position *Pos);
+
 /******************************************************************************
  * attack tables
  */
 
-extern const bitboard KNIGHT_ATT[NUM_SQUARES];
-extern const bitboard KING_ATT[NUM_SQUARES];
-extern const bitboard FILE_ATT[NUM_RANKS][64];
+extern bitboard KNIGHT_ATT[NUM_SQUARES];
+extern bitboard KING_ATT[NUM_SQUARES];
+extern bitboard FILE_ATT[NUM_RANKS][64];
+
+/* squares strictly between two squares sharing a rank, file or diagonal, and
+   the whole line through them (both empty if they don't share a line) */
+extern bitboard BETWEEN[NUM_SQUARES][NUM_SQUARES];
+extern bitboard LINE[NUM_SQUARES][NUM_SQUARES];
 
 #define FILEATTINDEX(Bd, Sq) (((Bd) >> (((Sq)&070)+1)) & 0x3f)
 
+/* magic bitboard tables for sliding attacks */
+typedef struct magic
+{
+  bitboard Mask;        // relevant occupancy, excluding the board edges
+  bitboard Magic;       // multiplier mapping relevant occupancy to an index
+  const bitboard *Att;  // attack sets for this square, indexed by the above
+  int Shift;            // 64 minus the number of bits in Mask
+} magic;
+
+#define BISHOP_ATT_SIZE 0x1480  // total attack sets for all bishop squares
+#define ROOK_ATT_SIZE   0x19000 // total attack sets for all rook squares
+
+extern magic BISHOP_MAGIC[NUM_SQUARES];
+extern magic ROOK_MAGIC[NUM_SQUARES];
+extern bitboard BISHOP_ATT[BISHOP_ATT_SIZE];
+extern bitboard ROOK_ATT[ROOK_ATT_SIZE];
+
+#define MAGICINDEX(M, Occ) ((((Occ) & (M)->Mask) * (M)->Magic) >> (M)->Shift)
+
+/* ways of indexing the slider attack tables */
+typedef enum sliderbackend
+{
+  SB_MAGIC,   // magic multiplication, works everywhere
+  SB_PEXT,    // BMI2 parallel bit extract
+
+  NUM_SLIDER_BACKENDS
+} sliderbackend;
+
+extern sliderbackend SliderBackend;
+extern const char *const SLIDER_BACKEND_NAME[NUM_SLIDER_BACKENDS];
+
+/******************************************************************************
+ * uint64 sliderIndex(const magic *M, bitboard Occ);
+ * PARAMETERS
+ *    M - the magic table entry for the square.
+ *    Occ - bitboard of the occupied squares.
+ * DESCRIPTION
+ *    Maps the relevant occupancy to an index into M->Att, using the backend
+ *    the tables were built for.
+ * RETURN VALUE
+ *    Returns the index.
+ */
+static inline uint64 sliderIndex(const magic *M, bitboard Occ)
+{
+#ifdef __x86_64__
+  if (SliderBackend == SB_PEXT)
+    return pextBd(Occ, M->Mask);
+#endif // #ifdef __x86_64__
+  return MAGICINDEX(M, Occ);
+}
+
 /******************************************************************************
  * bitboard diagonalAtt(bitboard Occ, square Sq);
  * PARAMETERS
@@ -187,51 +357,140 @@ static inline bitboard fileAtt(bitboard Occ, square Sq)
 }
 
 /******************************************************************************
- * attacked
- * Determines whether Sq is attacked by player Attacker.
- * Returns true if attacked, false otherwise.
+ * bitboard bishopAtt(bitboard Occ, square Sq);
+ * PARAMETERS
+ *    Occ - bitboard of the occupied squares.
+ *    Sq - the square from which to compute attacks.
+ * DESCRIPTION
+ *    Generate diagonal and antidiagonal sliding attacks from Sq when the
+ *    squares in Occ are occupied, using the slider attack tables.
+ * RETURN VALUE
+ *    Returns a bitboard with all squares that can be attacked by a bishop
+ *    on Sq.
  */
+static inline bitboard bishopAtt(bitboard Occ, square Sq)
+{
+  const magic *const M = &BISHOP_MAGIC[Sq];
+  return M->Att[sliderIndex(M, Occ)];
+}
+
 /******************************************************************************
- * int attacked(const position *Pos, square Sq, color Attacker);
+ * bitboard rookAtt(bitboard Occ, square Sq);
+ * PARAMETERS
+ *    Occ - bitboard of the occupied squares.
+ *    Sq - the square from which to compute attacks.
+ * DESCRIPTION
+ *    Generate rank and file sliding attacks from Sq when the squares in Occ
+ *    are occupied, using the slider attack tables.
+ * RETURN VALUE
+ *    Returns a bitboard with all squares that can be attacked by a rook on
+ *    Sq.
+ */
+static inline bitboard rookAtt(bitboard Occ, square Sq)
+{
+  const magic *const M = &ROOK_MAGIC[Sq];
+  return M->Att[sliderIndex(M, Occ)];
+}
+
+/******************************************************************************
+ * bitboard pawnAttackers(square Sq, color Attacker);
+ * PARAMETERS
+ *    Sq - the square that we're looking for attacks on.
+ *    Attacker - the color of the attacking pawns.
+ * DESCRIPTION
+ *    Determines the squares from which a pawn of color Attacker would attack
+ *    Sq.
+ * RETURN VALUE
+ *    Returns a bitboard of the squares.
+ */
+static inline bitboard pawnAttackers(square Sq, color Attacker)
+{
+  static const int PAWN_SHIFT[2] = {7, 9};
+  const int KingSide = !Attacker; // king-side element of PAWN_SHIFT array
+
+  return (SQMASK(Sq) >> PAWN_SHIFT[!KingSide])
+       | (SQMASK(Sq) << PAWN_SHIFT[KingSide]);
+}
+
+/******************************************************************************
+ * bitboard attackersOf(const position *Pos, square Sq, color Attacker,
+ *                      bitboard Occ);
  * PARAMETERS
  *    Pos - pointer to the position in which we're looking for attacks.
  *    Sq - the square that we're looking for attacks on.
  *    Attacker - the color we're looking for attacks by.
+ *    Occ - the occupied squares to use for sliding attacks, which may differ
+ *        from Pos->Occ (e.g. with the defending king removed).
  * DESCRIPTION
- *    Determines whether Sq is attacked by Attacker in *Pos.
+ *    Finds all pieces of color Attacker in *Pos that attack Sq.
+ * RETURN VALUE
+ *    Returns a bitboard of the attacking pieces.
+ */
+static inline bitboard attackersOf(const position *Pos, square Sq,
+    color Attacker, bitboard Occ)
+{
+  const bitboard *const Pc = Pos->OccBy[Attacker];
+
+  return (rookAtt(Occ, Sq) & (Pc[ROOK] | Pc[QUEEN]))
+       | (bishopAtt(Occ, Sq) & (Pc[BISHOP] | Pc[QUEEN]))
+       | (KNIGHT_ATT[Sq] & Pc[KNIGHT])
+       | (KING_ATT[Sq] & Pc[KING])
+       | (pawnAttackers(Sq, Attacker) & Pc[PAWN]);
+}
+
+/******************************************************************************
+ * int attackedOcc(const position *Pos, square Sq, color Attacker,
+ *                 bitboard Occ);
+ * PARAMETERS
+ *    Pos - pointer to the position in which we're looking for attacks.
+ *    Sq - the square that we're looking for attacks on.
+ *    Attacker - the color we're looking for attacks by.
+ *    Occ - the occupied squares to use for sliding attacks.
+ * DESCRIPTION
+ *    Determines whether Sq is attacked by Attacker in *Pos, with sliding
+ *    attacks blocked only by the squares in Occ.
  * RETURN VALUE
  *    Returns non-zero if Sq is attacked, or zero if it is not attacked.
  */
-static inline int attacked(const position *Pos, square Sq, color Attacker)
+static inline int attackedOcc(const position *Pos, square Sq, color Attacker,
+    bitboard Occ)
 {
-  static const int PAWN_SHIFT[2] = {7, 9};
-  const int KingSide = !Attacker; // king-side element of PAWN_SHIFT array
-  bitboard Bd;
+  const bitboard *const Pc = Pos->OccBy[Attacker];
 
-  // rook-like attacks
-  Bd = fileAtt(Pos->Occ, Sq) | rankAtt(Pos->Occ, Sq);
-  if (Bd & (Pos->OccBy[Attacker][ROOK] | Pos->OccBy[Attacker][QUEEN]))
+  // the table lookups are cheapest, so try them first
+  if (KNIGHT_ATT[Sq] & Pc[KNIGHT])
     return 1;
-  // bishop-like attacks
-  Bd = diagonalAtt(Pos->Occ, Sq) | antidiagAtt(Pos->Occ, Sq);
-  if (Bd & (Pos->OccBy[Attacker][BISHOP] | Pos->OccBy[Attacker][QUEEN]))
+  if (KING_ATT[Sq] & Pc[KING])
     return 1;
-  // knight attacks
-  if (KNIGHT_ATT[Sq] & Pos->OccBy[Attacker][KNIGHT])
+  if (pawnAttackers(Sq, Attacker) & Pc[PAWN])
     return 1;
-  // king attacks
-  if (KING_ATT[Sq] & Pos->OccBy[Attacker][KING])
+  // rook-like attacks
+  if (rookAtt(Occ, Sq) & (Pc[ROOK] | Pc[QUEEN]))
     return 1;
-  // pawn attacks
-  Bd = (SQMASK(Sq) >> PAWN_SHIFT[!KingSide])
-       | (SQMASK(Sq) << PAWN_SHIFT[KingSide]);
-  if (Bd & Pos->OccBy[Attacker][PAWN])
+  // bishop-like attacks
+  if (bishopAtt(Occ, Sq) & (Pc[BISHOP] | Pc[QUEEN]))
     return 1;
 
   // not attacked
   return 0;
 }
 
+/******************************************************************************
+ * int attacked(const position *Pos, square Sq, color Attacker);
+ * PARAMETERS
+ *    Pos - pointer to the position in which we're looking for attacks.
+ *    Sq - the square that we're looking for attacks on.
+ *    Attacker - the color we're looking for attacks by.
+ * DESCRIPTION
+ *    Determines whether Sq is attacked by Attacker in *Pos.
+ * RETURN VALUE
+ *    Returns non-zero if Sq is attacked, or zero if it is not attacked.
+ */
+static inline int attacked(const position *Pos, square Sq, color Attacker)
+{
+  return attackedOcc(Pos, Sq, Attacker, Pos->Occ);
+}
+
 #endif // #ifndef VAPOR__MOVES_H
 
 /* end of file */
@@ -30,33 +30,33 @@ int getLANStr(move Move, char Str[])
 {
   int i = 0;
 
-  assert(Move.Piece >= PAWN && Move.Piece <= KING);
-  assert(Move.Orig >= a1 && Move.Orig <= h8);
-  assert(Move.Dest >= a1 && Move.Dest <= h8);
+  assert(getPiece(Move) >= PAWN && getPiece(Move) <= KING);
+  assert(getOrig(Move) >= a1 && getOrig(Move) <= h8);
+  assert(getDest(Move) >= a1 && getDest(Move) <= h8);
 
-  if (Move.Type == MT_CASTLE)
+  if (getMoveType(Move) == MT_CASTLE)
   {
-    if (Move.Dest > Move.Orig)
+    if (getDest(Move) > getOrig(Move))
       strcpy(Str, "O-O");   // king-side
     else
       strcpy(Str, "O-O-O"); // queen-side
   }
   else
   {
-    if (Move.Piece > PAWN)
-      Str[i++] = PIECE_CHAR[Move.Piece];
-    Str[i++] = SQUARE_NAME[Move.Orig][0];
-    Str[i++] = SQUARE_NAME[Move.Orig][1];
-    if (Move.CaptPc == NO_PIECE)
+    if (getPiece(Move) > PAWN)
+      Str[i++] = PIECE_CHAR[getPiece(Move)];
+    Str[i++] = SQUARE_NAME[getOrig(Move)][0];
+    Str[i++] = SQUARE_NAME[getOrig(Move)][1];
+    if (getCaptPc(Move) == NO_PIECE)
       Str[i++] = '-';
     else
       Str[i++] = 'x';
-    Str[i++] = SQUARE_NAME[Move.Dest][0];
-    Str[i++] = SQUARE_NAME[Move.Dest][1];
-    if (Move.PromPc != NO_PIECE)
+    Str[i++] = SQUARE_NAME[getDest(Move)][0];
+    Str[i++] = SQUARE_NAME[getDest(Move)][1];
+    if (getPromPc(Move) != NO_PIECE)
     {
       Str[i++] = '=';
-      Str[i++] = PIECE_CHAR[Move.PromPc];
+      Str[i++] = PIECE_CHAR[getPromPc(Move)];
     }
     Str[i++] = 0;
   }
@@ -50,18 +50,18 @@ static inline square strToSquare(const char *s)
 int getLANStr(move Move, char Str[]);
 static inline int getCoordStr(move Move, char MoveStr[])
 {
-  assert(Move.Orig >= a1 && Move.Orig <= h8);
-  assert(Move.Dest >= a1 && Move.Dest <= h8);
+  assert(getOrig(Move) >= a1 && getOrig(Move) <= h8);
+  assert(getDest(Move) >= a1 && getDest(Move) <= h8);
 
-  MoveStr[0] = SQUARE_NAME[Move.Orig][0];
-  MoveStr[1] = SQUARE_NAME[Move.Orig][1];
-  MoveStr[2] = SQUARE_NAME[Move.Dest][0];
-  MoveStr[3] = SQUARE_NAME[Move.Dest][1];
-  if (Move.PromPc == NO_PIECE)
+  MoveStr[0] = SQUARE_NAME[getOrig(Move)][0];
+  MoveStr[1] = SQUARE_NAME[getOrig(Move)][1];
+  MoveStr[2] = SQUARE_NAME[getDest(Move)][0];
+  MoveStr[3] = SQUARE_NAME[getDest(Move)][1];
+  if (getPromPc(Move) == NO_PIECE)
     MoveStr[4] = 0;
   else
   {
-    MoveStr[4] = PIECE_CHAR[Move.PromPc];
+    MoveStr[4] = PIECE_CHAR[getPromPc(Move)];
     MoveStr[5] = 0;
   }
 
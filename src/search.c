@@ -17,14 +17,16 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
+#include <time.h>
 
 #define CLOCK_NODES 1024 // check clock roughly every millisecond 
 #define INPUT_NODES (32*CLOCK_NODES)  // roughly 30 times per second
 
 uint16 Now = 0; // number of calls to searchRoot, used for hash aging
 
-zobrist SearchHist[MAX_ZHIST_LEN*2];
-int HistLength;
+static THREAD_LOCAL zobrist SearchHist[MAX_ZHIST_LEN*2];
+static THREAD_LOCAL int HistLength;
 
 void (*printPV)(void) = NULL;
 void (*checkInput)(void) = NULL;
@@ -36,9 +38,31 @@ typedef struct variation
   hash_entry Hash[MAX_PLY];
 } variation;
 
+/* search state private to each thread */
+static THREAD_LOCAL move Killers[MAX_PLY][2];   // quiet moves that cut off
+static THREAD_LOCAL int History[NUM_SQUARES][NUM_SQUARES]; // by orig and dest
+static THREAD_LOCAL int ThreadId;               // 0 for the main thread
+static THREAD_LOCAL int64 Nodes;
+
+/* shared with the helper threads */
+static const move *RootMoves;         // legal root moves, in the initial order
+static int nRootMoves;
+static volatile int64 HelperNodes[MAX_THREADS]; // published by each helper
+static int64 HelperTotal;             // main thread's last sum of HelperNodes
+
+/* the pool of idle threads for split points, protected by PoolLock */
+static pthread_mutex_t PoolLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t PoolCond = PTHREAD_COND_INITIALIZER;
+static struct splitpoint *OpenSplits; // split points accepting helpers
+static volatile int nIdle;            // threads waiting for a split point
+static int SearchDone;                // set when the helpers should exit
+
 /* globals */
-int StopSearch;
-int64 Nodes;
+struct searchdata Search;
+struct pvdata PVData;
+int SearchThreads = 1;
+smpmode SMPMode = SMP_LAZY;
+volatile int StopSearch;
 microtime StopTime;
 microtime ExtStopTime;
 
@@ -85,6 +109,14 @@ microtime setupClock(void)
 
 static inline int timeToStop(void)
 {
+  // helpers just publish their node counts and wait for the main thread
+  if (ThreadId)
+  {
+    if (Nodes%CLOCK_NODES == 0)
+      HelperNodes[ThreadId] = Nodes;
+    return StopSearch;
+  }
+
   if (checkInput && Nodes%INPUT_NODES == 0)
   {
     checkInput();
@@ -97,7 +129,13 @@ static inline int timeToStop(void)
 
   if (!(Search.Flags & SF_PONDER) && !(Search.Flags & SF_INFINITE))
   {
-    if (Search.MaxNodes && Nodes >= Search.MaxNodes)
+    if (SearchThreads > 1 && Nodes%CLOCK_NODES == 0)
+    {
+      HelperTotal = 0;
+      for (int i = 1; i < SearchThreads; i++)
+        HelperTotal += HelperNodes[i];
+    }
+    if (Search.MaxNodes && Nodes + HelperTotal >= Search.MaxNodes)
     {
       StopSearch = 1;
       return 1;
@@ -112,6 +150,33 @@ static inline int timeToStop(void)
   return 0;
 }
 
+/******************************************************************************
+ * void pollStop(void);
+ * DESCRIPTION
+ *    Checks for input and whether the node or time limit has been reached,
+ *    for the main thread when it is waiting rather than searching nodes.
+ * RETURN VALUE
+ *    Does not return a value.
+ */
+static void pollStop(void)
+{
+  if (checkInput)
+    checkInput();
+  if (Search.Flags & SF_STOPPED)
+    StopSearch = 1;
+
+  if (!(Search.Flags & SF_PONDER) && !(Search.Flags & SF_INFINITE))
+  {
+    HelperTotal = 0;
+    for (int i = 1; i < SearchThreads; i++)
+      HelperTotal += HelperNodes[i];
+    if (Search.MaxNodes && Nodes + HelperTotal >= Search.MaxNodes)
+      StopSearch = 1;
+    else if (StopTime && getMicroTime() >= StopTime)
+      StopSearch = 1;
+  }
+}
+
 static inline int hashScore(int Score, int CurPly)
 {
   if (Score >= LONG_MATE) {
@@ -134,98 +199,97 @@ static inline int unhashScore(int Score, int CurPly)
   }
 }
 
-int search(const position *Pos, int Ply, int Depth, int Alpha, int Beta,
+int search(position *Pos, int Ply, int Depth, int Alpha, int Beta,
            variation *LocalPV);
-int quiesce(const position *Pos, int Alpha, int Beta);
+int quiesce(position *Pos, int Ply, int Alpha, int Beta);
+static void idleLoop(void);
 
-void searchRoot(void)
+/******************************************************************************
+ * void resetThreadState(void);
+ * DESCRIPTION
+ *    Sets up the calling thread's private search state for a new search: the
+ *    repetition history, node count, and move ordering data.
+ * RETURN VALUE
+ *    Does not return a value.
+ */
+static void resetThreadState(void)
 {
-  int i, j;
-  int MvBase;
-  int nMoves;
-  move *MoveList;
-  position *PosList;
-  int Val;
-  int BestVal = -INFINITY;
-  int BestMove = 0;
-  microtime StartTime;
-  int Depth, MaxDepth = Search.MaxDepth?Search.MaxDepth:MAX_SEARCH_DEPTH;
-  move TmpMove;
-  position TmpPos;
-  variation NewPV;
-  const hash_entry *OldHash;
-  hash_entry PVHash[MAX_PLY];
-
-  Now++;
-
-  // set up search history
   HistLength = ZHistLength;
   memcpy(SearchHist, ZobHistory, HistLength*sizeof(zobrist));
-
-
-  StartTime = setupClock();
+  memset(Killers, 0, sizeof(Killers));
+  memset(History, 0, sizeof(History));
   Nodes = 1;
   resetMoveStack();
-  MvBase = getMoveStackTop();
-  nMoves = genCaptures(CurPos) + genQuietMoves(CurPos);
+}
 
-  PosList = calloc(nMoves, sizeof(position));
-  MoveList = calloc(nMoves, sizeof(move));
+/******************************************************************************
+ * int64 totalNodes(void);
+ * DESCRIPTION
+ *    Adds the nodes searched by the main thread to those last published by
+ *    the helper threads. Only called by the main thread.
+ * RETURN VALUE
+ *    Returns the total number of nodes searched.
+ */
+static int64 totalNodes(void)
+{
+  int64 Total = Nodes;
 
-  // make all moves, removing illegal moves
-  for (i = 0, j = 0; i < nMoves; i++)
-  {
-    PosList[j] = *CurPos;
-    if (quickMakeMove(&PosList[j], MoveStack[MvBase+i]) == 0)
-      MoveList[j++] = MoveStack[MvBase+i];
-  }
-  resetMoveStack();
-  nMoves = j;
-  // note that the following frees the memory if nMoves is zero
-  PosList = realloc(PosList, nMoves*sizeof(position));
-  MoveList = realloc(MoveList, nMoves*sizeof(move));
-  if (!nMoves) // no legal moves
-  {
-    PVData.Length = 0;
-    return;
-  }
+  for (int i = 1; i < SearchThreads; i++)
+    Total += HelperNodes[i];
+  return Total;
+}
 
-  // lookup hash move
-  OldHash = hashLookup(CurPos->ZKey);
-  if (OldHash && OldHash->Move) {
-    for (i = 0; i < nMoves; i++) {
-      if (OldHash->Move == getHashMove(&MoveList[i])) {
-        BestMove = i;
-        break;
-      }
-    }
-  }
+/******************************************************************************
+ * void iterate(move *MoveList, int BestMove, int MaxDepth,
+ *              microtime StartTime);
+ * PARAMETERS
+ *    MoveList - the legal root moves, reordered as the search goes on.
+ *    BestMove - index in MoveList of the move to search first.
+ *    MaxDepth - the deepest iteration to search.
+ *    StartTime - the time the search started.
+ * DESCRIPTION
+ *    The iterative deepening loop. The main thread keeps the PV data, stores
+ *    the PV in the hash and reports each iteration. Helper threads only feed
+ *    the shared hash; the odd ones start one ply deeper, so that the threads
+ *    spread out over different depths.
+ * RETURN VALUE
+ *    Does not return a value.
+ */
+static void iterate(move *MoveList, int BestMove, int MaxDepth,
+    microtime StartTime)
+{
+  position Pos = *CurPos; // the position searched by make/unmake
+  undo Undo;
+  int Val;
+  int BestVal;
+  int Depth;
+  move TmpMove;
+  variation NewPV;
+  hash_entry PVHash[MAX_PLY];
+  int i, j;
 
-  // iterative deepening
-  for (Depth = 1; Depth <= MaxDepth; Depth++)
+  for (Depth = 1 + (ThreadId & 1); Depth <= MaxDepth; Depth++)
   {
     BestVal = -INFINITY;
     if (BestMove > 0)
     {
       // put previous best move at the front of the list (move others down)
       TmpMove = MoveList[BestMove];
-      TmpPos = PosList[BestMove];
       for (i = BestMove; i > 0; i--)
-      {
         MoveList[i] = MoveList[i-1];
-        PosList[i] = PosList[i-1];
-      }
       MoveList[0] = TmpMove;
-      PosList[0] = TmpPos;
       BestMove = 0;
     }
 
     // begin search
-    for (i = 0; i < nMoves; i++)
+    for (i = 0; i < nRootMoves; i++)
     {
       NewPV.Length = 0;
-      SearchHist[HistLength++] = CurPos->ZKey;
-      Val = -search(&PosList[i], 1, Depth-1, -INFINITY, -BestVal, &NewPV);
+      SearchHist[HistLength++] = Pos.ZKey;
+      makeMove(&Pos, MoveList[i], &Undo);
+      prefetchHash(Pos.ZKey);
+      Val = -search(&Pos, 1, Depth-1, -INFINITY, -BestVal, &NewPV);
+      unmakeMove(&Pos, MoveList[i], &Undo);
       HistLength--;
       resetMoveStack();
       if (StopSearch)
@@ -237,6 +301,8 @@ void searchRoot(void)
       {
         BestVal = Val;
         BestMove = i;
+        if (ThreadId)
+          continue;
         PVData.Val = Val;
         PVData.Depth = Depth;
         PVData.Length = NewPV.Length + 1;
@@ -247,14 +313,16 @@ void searchRoot(void)
         }
       }
     }
+    if (ThreadId)
+      continue;
 
     // store node and time info in PVData
     PVData.Time = getMicroTime() - StartTime;
-    PVData.Nodes = Nodes;
+    PVData.Nodes = totalNodes();
     if (PVData.Time > 0)
-      PVData.NodesPerSec = (Nodes*ONE_SEC)/PVData.Time;
+      PVData.NodesPerSec = (PVData.Nodes*ONE_SEC)/PVData.Time;
     else
-      PVData.NodesPerSec = Nodes;
+      PVData.NodesPerSec = PVData.Nodes;
 
     // store PV positions in hash
     PVHash[0].ZKey = CurPos->ZKey;
@@ -262,7 +330,7 @@ void searchRoot(void)
     PVHash[0].Depth = PVData.Depth;
     PVHash[0].When = Now;
     PVHash[0].Score = hashScore(PVData.Val, 0);
-    PVHash[0].Move = getHashMove(&PVData.Move[0]);
+    PVHash[0].Move = getHashMove(PVData.Move[0]);
     for (i = 0; i < PVData.Length; i++) {
       saveToHash(&PVHash[i]);
     }
@@ -271,63 +339,769 @@ void searchRoot(void)
     if (printPV)
       printPV();
   }
+}
+
+/******************************************************************************
+ * void *helperMain(void *Id);
+ * PARAMETERS
+ *    Id - the thread's index, cast to a pointer.
+ * DESCRIPTION
+ *    Entry point of the helper threads. With Lazy SMP they search the root
+ *    moves with their own private state until the main thread stops them;
+ *    otherwise they help out at split points.
+ * RETURN VALUE
+ *    Returns NULL.
+ */
+static void *helperMain(void *Id)
+{
+  move *MoveList;
+
+  ThreadId = (int)(intptr_t)Id;
+  resetThreadState();
+  if (SMPMode == SMP_YBWC)
+    idleLoop();
+  else if ((MoveList = malloc(nRootMoves*sizeof(move))))
+  {
+    memcpy(MoveList, RootMoves, nRootMoves*sizeof(move));
+    iterate(MoveList, 0, MAX_SEARCH_DEPTH, 0);
+    free(MoveList);
+  }
+
+  HelperNodes[ThreadId] = Nodes;
+  freeMoveStack();
+  return NULL;
+}
+
+void searchRoot(void)
+{
+  int i;
+  int MvBase;
+  int nMoves;
+  checkinfo CI;
+  move *MoveList;
+  int BestMove = 0;
+  microtime StartTime;
+  hash_entry OldHash;
+  pthread_t Helpers[MAX_THREADS];
+  int nHelpers = 0;
+
+  Now++;
+
+  // set up search history and forget move ordering data from the last search
+  resetThreadState();
+
+  StartTime = setupClock();
+  MvBase = getMoveStackTop();
+  if (CurPos->Flags & PF_CHECK)
+    nMoves = genCheckEvasions(CurPos);
+  else
+  {
+    getCheckInfo(CurPos, &CI);
+    nMoves = genCaptures(CurPos, &CI) + genQuietMoves(CurPos, &CI);
+  }
+
+  if (!nMoves) // no legal moves
+  {
+    PVData.Length = 0;
+    return;
+  }
+
+  // copy the moves (the generators only produce legal moves)
+  MoveList = malloc(nMoves*sizeof(move));
+  memcpy(MoveList, &MoveStack[MvBase], nMoves*sizeof(move));
+  resetMoveStack();
+
+  // lookup hash move
+  if (hashLookup(CurPos->ZKey, &OldHash) && OldHash.Move) {
+    for (i = 0; i < nMoves; i++) {
+      if (OldHash.Move == getHashMove(MoveList[i])) {
+        BestMove = i;
+        break;
+      }
+    }
+  }
+
+  // start the helpers, which share only the hash with the main thread
+  RootMoves = MoveList;
+  nRootMoves = nMoves;
+  HelperTotal = 0;
+  SearchDone = 0;
+  for (i = 1; i < SearchThreads; i++)
+  {
+    HelperNodes[i] = 0;
+    if (pthread_create(&Helpers[nHelpers], NULL, helperMain,
+        (void *)(intptr_t)i) == 0)
+      nHelpers++;
+  }
+
+  iterate(MoveList, BestMove, Search.MaxDepth?Search.MaxDepth:MAX_SEARCH_DEPTH,
+      StartTime);
+
+  // stop the helpers and count their nodes
+  StopSearch = 1;
+  pthread_mutex_lock(&PoolLock);
+  SearchDone = 1;
+  pthread_cond_broadcast(&PoolCond);
+  pthread_mutex_unlock(&PoolLock);
+  for (i = 0; i < nHelpers; i++)
+    pthread_join(Helpers[i], NULL);
+  PVData.Nodes = totalNodes();
+  if (PVData.Time > 0)
+    PVData.NodesPerSec = (PVData.Nodes*ONE_SEC)/PVData.Time;
 
+  RootMoves = NULL;
   free(MoveList);
-  free(PosList);
   resetMoveStack();
 }
 
-typedef enum searchstate
+#define MAX_MOVES 256  // more than the most legal moves in any position
+
+// piece values for static exchange evaluation, including the king
+static const int SEE_VAL[NUM_PIECES + 1] = {
+    0, 100, 320, 330, 500, 1000, 20000
+};
+
+/******************************************************************************
+ * int see(const position *Pos, move Move);
+ * PARAMETERS
+ *    Pos - pointer to the position.
+ *    Move - a capture in Pos.
+ * DESCRIPTION
+ *    Static exchange evaluation: plays out the sequence of captures on the
+ *    destination square of Move, each side capturing with its least valuable
+ *    attacker and stopping whenever that is better than going on.
+ * RETURN VALUE
+ *    Returns the expected material gain of Move for the mover.
+ */
+static int see(const position *Pos, move Move)
+{
+  const square Dest = getDest(Move);
+  const bitboard Diag = Pos->OccBy[WHITE][BISHOP] | Pos->OccBy[BLACK][BISHOP]
+      | Pos->OccBy[WHITE][QUEEN] | Pos->OccBy[BLACK][QUEEN];
+  const bitboard Straight = Pos->OccBy[WHITE][ROOK] | Pos->OccBy[BLACK][ROOK]
+      | Pos->OccBy[WHITE][QUEEN] | Pos->OccBy[BLACK][QUEEN];
+  color Side = (Pos->Flags & PF_WHITEMOVE)? BLACK : WHITE;
+  bitboard Occ = Pos->Occ ^ SQMASK(getOrig(Move));
+  bitboard Attackers;
+  bitboard Bd = 0;
+  piece Attacker = getPiece(Move);
+  int Gain[32];
+  int d = 0;
+
+  if (Dest == Pos->EPSquare && Attacker == PAWN)
+    Occ ^= SQMASK(SQUARE(FILE(Dest), RANK(getOrig(Move))));
+  Attackers = (attackersOf(Pos, Dest, WHITE, Occ)
+      | attackersOf(Pos, Dest, BLACK, Occ)) & Occ;
+
+  Gain[0] = SEE_VAL[getCaptPc(Move)];
+  while (d < 31)
+  {
+    // value of the last capturing piece if it's taken in turn
+    d++;
+    Gain[d] = SEE_VAL[Attacker] - Gain[d-1];
+    if (max(-Gain[d-1], Gain[d]) < 0)
+      break; // neither side can gain by going on
+
+    // find the least valuable attacker
+    for (Attacker = PAWN; Attacker <= KING; Attacker++)
+    {
+      Bd = Attackers & Pos->OccBy[Side][Attacker];
+      if (Bd)
+        break;
+    }
+    if (!Bd)
+      break;
+
+    // remove it and add any x-ray attackers behind it
+    Occ ^= Bd & -Bd;
+    Attackers |= (bishopAtt(Occ, Dest) & Diag)
+        | (rookAtt(Occ, Dest) & Straight);
+    Attackers &= Occ;
+    Side = !Side;
+  }
+
+  while (--d)
+    Gain[d-1] = -max(-Gain[d-1], Gain[d]);
+  return Gain[0];
+}
+
+/******************************************************************************
+ * the move picker
+ */
+
+typedef enum pickstage
+{
+  PS_HASH,
+  PS_GEN_CAPTURES,
+  PS_GOOD_CAPTURES,
+  PS_KILLER1,
+  PS_KILLER2,
+  PS_GEN_QUIETS,
+  PS_QUIETS,
+  PS_BAD_CAPTURES,
+  PS_GEN_EVASIONS,
+  PS_EVASIONS,
+  PS_DONE,
+} pickstage;
+
+typedef struct movepicker
+{
+  const position *Pos;
+  checkinfo CI;             // pins and checks, found once for all stages
+  int CapturesOnly;         // for qsearch: no quiets and no bad captures
+  pickstage Stage;
+  move HashMove;
+  move Killer[2];           // this ply's killers, cleared if not legal here
+  int nMoves;               // moves in the current stage
+  int Next;                 // index of the next move to pick
+  int nBad;                 // number of deferred bad captures
+  move Moves[MAX_MOVES];
+  int Score[MAX_MOVES];
+  move Bad[MAX_MOVES];
+} movepicker;
+
+/******************************************************************************
+ * void initPicker(movepicker *MP, const position *Pos, int Ply,
+ *                 hashmove HashMove, int CapturesOnly);
+ * PARAMETERS
+ *    MP - the move picker to set up.
+ *    Pos - the position to pick moves for.
+ *    Ply - number of plies from the root, for the killer moves.
+ *    HashMove - move from the transposition table, or zero.
+ *    CapturesOnly - non-zero to pick only the good captures and promotions
+ *       (or all evasions when in check), as in qsearch.
+ * DESCRIPTION
+ *    Prepares MP to hand out the moves for Pos in stages: the hash move, good
+ *    captures by MVV/LVA, killers, quiet moves by history, then bad captures.
+ *    Nothing is generated or scored until its stage is reached. The killers
+ *    are copied now, since at a split point the picker is shared by threads
+ *    that each have their own killer table.
+ */
+static void initPicker(movepicker *MP, const position *Pos, int Ply,
+    hashmove HashMove, int CapturesOnly)
+{
+  MP->Pos = Pos;
+  MP->CapturesOnly = CapturesOnly;
+  MP->HashMove = NO_MOVE;
+  MP->Killer[0] = MP->Killer[1] = NO_MOVE;
+  MP->nMoves = MP->Next = MP->nBad = 0;
+
+  if (Pos->Flags & PF_CHECK)
+  {
+    MP->Stage = PS_GEN_EVASIONS;
+    return;
+  }
+
+  getCheckInfo(Pos, &MP->CI);
+  if (CapturesOnly)
+    MP->Stage = PS_GEN_CAPTURES;
+  else
+  {
+    MP->Stage = PS_HASH;
+    if (HashMove && expandMove(Pos, &MP->CI, HashMove, &MP->HashMove) != 0)
+      MP->HashMove = NO_MOVE;
+    if (Ply < MAX_PLY)
+    {
+      MP->Killer[0] = Killers[Ply][0];
+      MP->Killer[1] = Killers[Ply][1];
+    }
+  }
+}
+
+/******************************************************************************
+ * void takeMoves(movepicker *MP, int MvBase, int nMoves);
+ * PARAMETERS
+ *    MP - the move picker.
+ *    MvBase - index of the first generated move on the move stack.
+ *    nMoves - number of generated moves.
+ * DESCRIPTION
+ *    Moves newly generated moves from the move stack into the picker as the
+ *    moves of the current stage, skipping the hash move.
+ */
+static inline void takeMoves(movepicker *MP, int MvBase, int nMoves)
 {
-  INIT_SEARCH,
-  CAPT_SEARCH,
-  ALL_SEARCH,
-  SEARCH_DONE,
-} searchstate;
-
-static inline int getNextMove(const position *Pos, int Index,
-    searchstate *State, int *StackTop)
+  MP->nMoves = MP->Next = 0;
+  for (int i = MvBase; i < MvBase + nMoves; i++)
+  {
+    if (MoveStack[i] != MP->HashMove)
+      MP->Moves[MP->nMoves++] = MoveStack[i];
+  }
+  popMoveStack(MvBase);
+}
+
+/******************************************************************************
+ * move pickBest(movepicker *MP);
+ * PARAMETERS
+ *    MP - the move picker.
+ * DESCRIPTION
+ *    One step of a selection sort: swaps the best scoring of the remaining
+ *    moves of the current stage to the front and hands it out.
+ * RETURN VALUE
+ *    Returns the move, or NO_MOVE if there are no moves left in the stage.
+ */
+static inline move pickBest(movepicker *MP)
 {
-  while (Index >= *StackTop)
+  int Best = MP->Next;
+  move Move;
+  int Score;
+
+  if (MP->Next >= MP->nMoves)
+    return NO_MOVE;
+
+  for (int i = Best + 1; i < MP->nMoves; i++)
   {
-    switch (*State)
+    if (MP->Score[i] > MP->Score[Best])
+      Best = i;
+  }
+
+  Move = MP->Moves[Best];
+  Score = MP->Score[Best];
+  MP->Moves[Best] = MP->Moves[MP->Next];
+  MP->Score[Best] = MP->Score[MP->Next];
+  MP->Moves[MP->Next] = Move;
+  MP->Score[MP->Next] = Score;
+  MP->Next++;
+
+  return Move;
+}
+
+/******************************************************************************
+ * int isKillerLegal(movepicker *MP, move Killer);
+ * PARAMETERS
+ *    MP - the move picker.
+ *    Killer - a killer move for the current ply.
+ * DESCRIPTION
+ *    Determines whether the killer can be searched here: it must be a legal
+ *    quiet move in the position and not be the hash move. The moved and
+ *    captured pieces are refreshed from the position by expandMove.
+ * RETURN VALUE
+ *    Returns non-zero if the killer should be searched.
+ */
+static inline int isKillerLegal(movepicker *MP, move Killer)
+{
+  move Move;
+
+  if (Killer == NO_MOVE || Killer == MP->HashMove)
+    return 0;
+  if (expandMove(MP->Pos, &MP->CI, getHashMove(Killer), &Move) != 0)
+    return 0;
+  return Move == Killer;
+}
+
+/******************************************************************************
+ * move nextMove(movepicker *MP);
+ * PARAMETERS
+ *    MP - the move picker.
+ * DESCRIPTION
+ *    Finds the next move to search, generating and scoring moves one stage at
+ *    a time.
+ * RETURN VALUE
+ *    Returns the next move, or NO_MOVE once all moves have been picked.
+ */
+static move nextMove(movepicker *MP)
+{
+  const int MvBase = getMoveStackTop();
+  move Move;
+  int i;
+
+  for (;;)
+  {
+    switch (MP->Stage)
     {
-      case INIT_SEARCH:
-        // TODO: search only check evasions if in check
-        *StackTop += genCaptures(Pos);
-        (*State)++;
+      case PS_HASH:
+        MP->Stage++;
+        if (MP->HashMove != NO_MOVE)
+          return MP->HashMove;
+        break;
+
+      case PS_GEN_CAPTURES:
+        // score by MVV/LVA with the queen promotions first
+        takeMoves(MP, MvBase, genCaptures(MP->Pos, &MP->CI));
+        for (i = 0; i < MP->nMoves; i++)
+        {
+          Move = MP->Moves[i];
+          MP->Score[i] = 8*getCaptPc(Move) - getPiece(Move);
+          if (getPromPc(Move) == QUEEN)
+            MP->Score[i] += 64;
+        }
+        MP->Stage++;
+        break;
+
+      case PS_GOOD_CAPTURES:
+        // defer losing captures and under-promotions, testing the exchange
+        // only when the capturing piece is worth more than its victim
+        while ((Move = pickBest(MP)) != NO_MOVE)
+        {
+          if (getPromPc(Move) == QUEEN
+              || (getPromPc(Move) == NO_PIECE
+                && (SEE_VAL[getCaptPc(Move)] >= SEE_VAL[getPiece(Move)]
+                  || see(MP->Pos, Move) >= 0)))
+            return Move;
+          MP->Bad[MP->nBad++] = Move;
+        }
+        MP->Stage = MP->CapturesOnly? PS_DONE : PS_KILLER1;
+        break;
+
+      case PS_KILLER1:
+      case PS_KILLER2:
+        i = MP->Stage - PS_KILLER1;
+        MP->Stage++;
+        if (isKillerLegal(MP, MP->Killer[i]))
+          return MP->Killer[i];
+        MP->Killer[i] = NO_MOVE; // so the quiet moves don't skip it
+        break;
+
+      case PS_GEN_QUIETS:
+        takeMoves(MP, MvBase, genQuietMoves(MP->Pos, &MP->CI));
+        for (i = 0; i < MP->nMoves; i++)
+        {
+          Move = MP->Moves[i];
+          MP->Score[i] = History[getOrig(Move)][getDest(Move)];
+        }
+        MP->Stage++;
+        break;
+
+      case PS_QUIETS:
+        while ((Move = pickBest(MP)) != NO_MOVE)
+        {
+          if (Move != MP->Killer[0] && Move != MP->Killer[1])
+            return Move;
+        }
+        MP->Next = 0;
+        MP->Stage++;
+        break;
+
+      case PS_BAD_CAPTURES:
+        if (MP->Next < MP->nBad)
+          return MP->Bad[MP->Next++];
+        MP->Stage = PS_DONE;
+        break;
+
+      case PS_GEN_EVASIONS:
+        // captures by MVV/LVA ahead of the other evasions by history
+        takeMoves(MP, MvBase, genCheckEvasions(MP->Pos));
+        for (i = 0; i < MP->nMoves; i++)
+        {
+          Move = MP->Moves[i];
+          if (getCaptPc(Move) != NO_PIECE || getPromPc(Move) != NO_PIECE)
+            MP->Score[i] = (1 << 24) + 8*getCaptPc(Move) - getPiece(Move);
+          else
+            MP->Score[i] = History[getOrig(Move)][getDest(Move)];
+        }
+        MP->Stage++;
         break;
-      case CAPT_SEARCH:
-        *StackTop += genQuietMoves(Pos);
-        (*State)++;
+
+      case PS_EVASIONS:
+        if ((Move = pickBest(MP)) != NO_MOVE)
+          return Move;
+        MP->Stage = PS_DONE;
         break;
-      case ALL_SEARCH:
-        // nothing left to search
-        (*State)++;
-        return -1;
+
       default:
-        (*State) = SEARCH_DONE;
-        return -1;
+        return NO_MOVE;
+    }
+  }
+}
+
+/******************************************************************************
+ * split points, for the young brothers wait parallel search
+ */
+
+// TODO: measure the 1 to 32 thread time-to-depth of this search on a
+//       many-core machine ("vapor bench --threads 32 --smp ybwc") and tune
+//       MIN_SPLIT_DEPTH from it; so far it has only run on a single core
+#define MIN_SPLIT_DEPTH 4 // shallower nodes aren't worth the overhead
+
+typedef struct splitpoint
+{
+  struct splitpoint *Parent;    // split point the owner was working under
+  struct splitpoint *NextOpen;  // next split point accepting helpers
+  position Pos;                 // position at the split point
+  movepicker *Picker;           // owner's picker, shared by all the workers
+  const zobrist *SearchHist;    // owner's repetition history
+  int HistLength;
+  int Ply;
+  int Depth;
+  int Beta;
+  int Alpha;                    // the rest are protected by Lock
+  int BestVal;
+  move BestMove;
+  int nLegalMoves;
+  variation PV;                 // PV below BestMove
+  int nWorkers;                 // threads working here, including the owner
+  int Exhausted;                // all moves have been handed out
+  volatile int Cutoff;          // a move failed high
+  pthread_mutex_t Lock;
+} splitpoint;
+
+static THREAD_LOCAL splitpoint *CurSplit; // innermost split point worked on
+
+/******************************************************************************
+ * int aborted(void);
+ * DESCRIPTION
+ *    Determines whether the calling thread should stop searching, either
+ *    because the whole search is stopping or because a move failed high at
+ *    one of the split points the thread is working under.
+ * RETURN VALUE
+ *    Returns non-zero if the search should stop.
+ */
+static inline int aborted(void)
+{
+  if (StopSearch)
+    return 1;
+  for (const splitpoint *SP = CurSplit; SP; SP = SP->Parent)
+  {
+    if (SP->Cutoff)
+      return 1;
+  }
+  return 0;
+}
+
+/******************************************************************************
+ * void workSplit(splitpoint *SP);
+ * PARAMETERS
+ *    SP - the split point to work on.
+ * DESCRIPTION
+ *    Takes moves from the split point's picker and searches them on a private
+ *    copy of the position until there are none left or one fails high.
+ * RETURN VALUE
+ *    Does not return a value.
+ */
+static void workSplit(splitpoint *SP)
+{
+  splitpoint *const OldSplit = CurSplit;
+  position Pos = SP->Pos;
+  variation NextPV;
+  undo Undo;
+  move Move;
+  int Alpha;
+  int Val;
+
+  if (SP->SearchHist != SearchHist) // a helper, with history of its own
+    memcpy(SearchHist, SP->SearchHist, SP->HistLength*sizeof(zobrist));
+  HistLength = SP->HistLength;
+  CurSplit = SP;
+
+  for (;;)
+  {
+    pthread_mutex_lock(&SP->Lock);
+    Move = aborted()? NO_MOVE : nextMove(SP->Picker);
+    if (Move == NO_MOVE)
+      SP->Exhausted = 1;
+    Alpha = SP->Alpha;
+    pthread_mutex_unlock(&SP->Lock);
+    if (Move == NO_MOVE)
+      break;
+
+    SearchHist[HistLength] = Pos.ZKey;
+    if (makeMove(&Pos, Move, &Undo) != 0)
+      continue;
+    prefetchHash(Pos.ZKey);
+    HistLength++;
+    NextPV.Length = 0;
+    Val = -search(&Pos, SP->Ply+1, SP->Depth-1, -SP->Beta, -Alpha, &NextPV);
+    HistLength--;
+    unmakeMove(&Pos, Move, &Undo);
+    if (aborted())
+      break;
+
+    pthread_mutex_lock(&SP->Lock);
+    SP->nLegalMoves++;
+    if (Val > SP->BestVal)
+    {
+      SP->BestVal = Val;
+      if (Val > SP->Alpha)
+      {
+        SP->Alpha = Val;
+        SP->BestMove = Move;
+        SP->PV.Length = NextPV.Length;
+        memcpy(SP->PV.Move, NextPV.Move, NextPV.Length*sizeof(move));
+        memcpy(SP->PV.Hash, NextPV.Hash, NextPV.Length*sizeof(hash_entry));
+        if (Val >= SP->Beta)
+          SP->Cutoff = 1;
+      }
+    }
+    pthread_mutex_unlock(&SP->Lock);
+  }
+
+  CurSplit = OldSplit;
+}
+
+/******************************************************************************
+ * int split(position *Pos, movepicker *Picker, int Ply, int Depth,
+ *           int *Alpha, int Beta, int *BestVal, move *BestMove,
+ *           int *nLegalMoves, variation *PV);
+ * PARAMETERS
+ *    Pos - the position being searched by the calling thread.
+ *    Picker - the picker with the remaining moves of Pos.
+ *    Ply, Depth, Beta - as in search().
+ *    Alpha, BestVal, BestMove, nLegalMoves, PV - the search() state of the
+ *        node, updated with the results of the remaining moves.
+ * DESCRIPTION
+ *    Searches the remaining moves of a node together with any idle threads.
+ *    The calling thread works on the moves too, and once they have all been
+ *    handed out, waits for the helpers to finish theirs.
+ * RETURN VALUE
+ *    Returns non-zero if one of the moves failed high.
+ */
+static int split(position *Pos, movepicker *Picker, int Ply, int Depth,
+    int *Alpha, int Beta, int *BestVal, move *BestMove, int *nLegalMoves,
+    variation *PV)
+{
+  const move OldBestMove = *BestMove;
+  splitpoint SP;
+  splitpoint **Link;
+  struct timespec Wait;
+
+  SP.Parent = CurSplit;
+  SP.Pos = *Pos;
+  SP.Picker = Picker;
+  SP.SearchHist = SearchHist;
+  SP.HistLength = HistLength;
+  SP.Ply = Ply;
+  SP.Depth = Depth;
+  SP.Beta = Beta;
+  SP.Alpha = *Alpha;
+  SP.BestVal = *BestVal;
+  SP.BestMove = *BestMove;
+  SP.nLegalMoves = *nLegalMoves;
+  SP.PV.Length = 0;
+  SP.nWorkers = 1;
+  SP.Exhausted = 0;
+  SP.Cutoff = 0;
+  pthread_mutex_init(&SP.Lock, NULL);
+  Picker->Pos = &SP.Pos; // Pos changes as the owner makes moves on it
+
+  // open it to the idle threads
+  pthread_mutex_lock(&PoolLock);
+  SP.NextOpen = OpenSplits;
+  OpenSplits = &SP;
+  pthread_cond_broadcast(&PoolCond);
+  pthread_mutex_unlock(&PoolLock);
+
+  workSplit(&SP);
+
+  // close it and wait for the helpers, polling for input and the clock if
+  // this is the main thread
+  pthread_mutex_lock(&PoolLock);
+  for (Link = &OpenSplits; *Link; Link = &(*Link)->NextOpen)
+  {
+    if (*Link == &SP)
+    {
+      *Link = SP.NextOpen;
+      break;
+    }
+  }
+  while (SP.nWorkers > 1)
+  {
+    if (ThreadId)
+      pthread_cond_wait(&PoolCond, &PoolLock);
+    else
+    {
+      clock_gettime(CLOCK_REALTIME, &Wait);
+      Wait.tv_nsec += 1000000;
+      if (Wait.tv_nsec >= 1000000000)
+      {
+        Wait.tv_sec++;
+        Wait.tv_nsec -= 1000000000;
+      }
+      pthread_cond_timedwait(&PoolCond, &PoolLock, &Wait);
+      pthread_mutex_unlock(&PoolLock);
+      pollStop();
+      pthread_mutex_lock(&PoolLock);
+    }
+  }
+  pthread_mutex_unlock(&PoolLock);
+
+  Picker->Pos = Pos;
+  pthread_mutex_destroy(&SP.Lock);
+  *Alpha = SP.Alpha;
+  *BestVal = SP.BestVal;
+  *BestMove = SP.BestMove;
+  *nLegalMoves = SP.nLegalMoves;
+  if (SP.BestMove != OldBestMove)
+    *PV = SP.PV;
+  return SP.Cutoff;
+}
+
+/******************************************************************************
+ * void idleLoop(void);
+ * DESCRIPTION
+ *    Main loop of the helper threads in the young brothers wait search: waits
+ *    for split points to be opened and works on them until the search ends.
+ * RETURN VALUE
+ *    Does not return a value.
+ */
+static void idleLoop(void)
+{
+  splitpoint *SP;
+
+  pthread_mutex_lock(&PoolLock);
+  while (!SearchDone)
+  {
+    for (SP = OpenSplits; SP && (SP->Exhausted || SP->Cutoff);
+        SP = SP->NextOpen)
+      ;
+    if (!SP)
+    {
+      nIdle++;
+      pthread_cond_wait(&PoolCond, &PoolLock);
+      nIdle--;
+      continue;
     }
+
+    SP->nWorkers++;
+    pthread_mutex_unlock(&PoolLock);
+    workSplit(SP);
+    pthread_mutex_lock(&PoolLock);
+    SP->nWorkers--;
+    pthread_cond_broadcast(&PoolCond);
+  }
+  pthread_mutex_unlock(&PoolLock);
+}
+
+/******************************************************************************
+ * void updateQuietStats(move Move, int Ply, int Depth);
+ * PARAMETERS
+ *    Move - a quiet move that caused a beta cut-off.
+ *    Ply - number of plies from the root.
+ *    Depth - remaining search depth.
+ * DESCRIPTION
+ *    Records Move as a killer for Ply and credits it in the history table.
+ */
+static inline void updateQuietStats(move Move, int Ply, int Depth)
+{
+  if (Ply < MAX_PLY && Killers[Ply][0] != Move)
+  {
+    Killers[Ply][1] = Killers[Ply][0];
+    Killers[Ply][0] = Move;
   }
 
-  return Index;
+  History[getOrig(Move)][getDest(Move)] += Depth*Depth;
+  if (History[getOrig(Move)][getDest(Move)] >= (1 << 20))
+  {
+    // keep history scores below those of capturing evasions
+    for (int i = 0; i < NUM_SQUARES; i++)
+    {
+      for (int j = 0; j < NUM_SQUARES; j++)
+        History[i][j] /= 2;
+    }
+  }
 }
 
-int search(const position *Pos, int Ply, int Depth, int Alpha, int Beta,
+int search(position *Pos, int Ply, int Depth, int Alpha, int Beta,
            variation *LocalPV)
 {
-  int StackTop = getMoveStackTop();
-  searchstate State = INIT_SEARCH;
-  int NextIndex = StackTop;
-  int Move;
+  movepicker Picker;
+  checkinfo CI;
+  move Move;
   int Val;
   int BestVal = -INFINITY;
-  int BestMove = -1;
+  move BestMove = NO_MOVE;
   int nLegalMoves = 0;
-  position NewPos;
+  undo Undo;
   variation NextPV;
-  const hash_entry *OldHash = NULL;
+  hash_entry OldHash;
   hash_entry NewHash = {
     Pos->ZKey,  // zobrist key
     upperbound, // bound on the value
@@ -355,69 +1129,61 @@ int search(const position *Pos, int Ply, int Depth, int Alpha, int Beta,
   if (Pos->Flags & PF_CHECK)
     Depth++;
 
-  OldHash = hashLookup(Pos->ZKey);
-  if (OldHash) {
-    Val = unhashScore(OldHash->Score, Ply);
-    if (OldHash->Depth >= Depth) {
+  if (hashLookup(Pos->ZKey, &OldHash)) {
+    Val = unhashScore(OldHash.Score, Ply);
+    HashMove = OldHash.Move;
+    if (OldHash.Depth >= Depth) {
       if (Val >= Beta) {
         // beta cut-off unless it's only an upper bound (could be lower)
-        if (OldHash->Bound != upperbound)
+        if (OldHash.Bound != upperbound)
           return Val;
       } else if (Val <= Alpha) {
         // alpha cut-off unless it's only a lower bound (could be higher)
-        if (OldHash->Bound != lowerbound)
+        if (OldHash.Bound != lowerbound)
           return Val;
-      } else if (OldHash->Bound == exactscore) {
+      } else if (OldHash.Bound == exactscore) {
         // Alpha < Exact Score < Beta ==> PV Node
-        HashMove = OldHash->Move;
         // for PV nodes fully verify move legality before returning
-        if (OldHash->Move && genHashMove(Pos, HashMove)) {
-          NewPos = *Pos;
-          if (quickMakeMove(&NewPos, MoveStack[NextIndex]) == 0) {
-            LocalPV->Length = 1;
-            LocalPV->Move[0] = MoveStack[NextIndex];
-            LocalPV->Hash[0] = *OldHash;
-            return Val;
-          } else {
-            NextIndex++; // no use retrying the move if it's not legal
-          }
+        getCheckInfo(Pos, &CI);
+        if (HashMove && expandMove(Pos, &CI, HashMove, &Move) == 0) {
+          LocalPV->Length = 1;
+          LocalPV->Move[0] = Move;
+          LocalPV->Hash[0] = OldHash;
+          return Val;
         }
         // since the move isn't legal, we've got a rare hash-key conflict
         // so lets just go on searching since we didn't find anything useful
       }
     }
-    // if there's a hash move that we haven't already tried
-    if (OldHash->Move && !HashMove) {
-      HashMove = OldHash->Move;
-      StackTop += genHashMove(Pos, HashMove);
-    }
   }
 
   // if leaf node, enter qsearch
   if (Depth <= 0)
-    return quiesce(Pos, Alpha, Beta);
+    return quiesce(Pos, Ply, Alpha, Beta);
 
   if (timeToStop())
     return INFINITY;
 
-  while ((Move = getNextMove(Pos, NextIndex++, &State, &StackTop)) >= 0)
+  initPicker(&Picker, Pos, Ply, HashMove, 0);
+  while ((Move = nextMove(&Picker)) != NO_MOVE)
   {
-    if (nLegalMoves && HashMove && OldHash->Move == getHashMove(&MoveStack[Move]))
-      continue; // no need to search the hashmove twice
-
-    NewPos = *Pos;
-    if (quickMakeMove(&NewPos, MoveStack[Move]) == 0)
+    SearchHist[HistLength] = Pos->ZKey;
+    if (makeMove(Pos, Move, &Undo) == 0)
     {
+      prefetchHash(Pos->ZKey);
       nLegalMoves++;
-      SearchHist[HistLength++] = Pos->ZKey;
-      Val = -search(&NewPos, Ply+1, Depth-1, -Beta, -Alpha, &NextPV);
+      HistLength++;
+      Val = -search(Pos, Ply+1, Depth-1, -Beta, -Alpha, &NextPV);
       HistLength--;
-      if (StopSearch)
+      unmakeMove(Pos, Move, &Undo);
+      if (aborted())
         return INFINITY;
       if (Val >= Beta) {
+        if (getCaptPc(Move) == NO_PIECE && getPromPc(Move) == NO_PIECE)
+          updateQuietStats(Move, Ply, Depth);
         NewHash.Score = hashScore(Val, Ply);
         NewHash.Bound = lowerbound;
-        NewHash.Move = getHashMove(&MoveStack[Move]);
+        NewHash.Move = getHashMove(Move);
         saveToHash(&NewHash);
         return Val;
       } else if (Val > Alpha) {
@@ -427,7 +1193,29 @@ int search(const position *Pos, int Ply, int Depth, int Alpha, int Beta,
         BestVal = Val;
       }
     }
-    popMoveStack(StackTop); // restore the stack for the next move
+
+    // once the eldest brother has been searched, share the rest of the moves
+    // with any idle threads
+    if (SMPMode == SMP_YBWC && nIdle && Depth >= MIN_SPLIT_DEPTH
+        && nLegalMoves && Picker.Stage != PS_DONE)
+    {
+      if (split(Pos, &Picker, Ply, Depth, &Alpha, Beta, &BestVal, &BestMove,
+          &nLegalMoves, &NextPV))
+      {
+        if (aborted())
+          return INFINITY;
+        if (getCaptPc(BestMove) == NO_PIECE && getPromPc(BestMove) == NO_PIECE)
+          updateQuietStats(BestMove, Ply, Depth);
+        NewHash.Score = hashScore(BestVal, Ply);
+        NewHash.Bound = lowerbound;
+        NewHash.Move = getHashMove(BestMove);
+        saveToHash(&NewHash);
+        return BestVal;
+      }
+      if (aborted())
+        return INFINITY;
+      break;
+    }
   }
 
   if (!nLegalMoves) {
@@ -441,11 +1229,11 @@ int search(const position *Pos, int Ply, int Depth, int Alpha, int Beta,
 
   NewHash.Score = hashScore(BestVal, Ply);
 
-  if (BestMove >= 0) {
+  if (BestMove != NO_MOVE) {
     NewHash.Bound = exactscore;
-    NewHash.Move = getHashMove(&MoveStack[BestMove]);
+    NewHash.Move = getHashMove(BestMove);
     LocalPV->Length = NextPV.Length + 1;
-    LocalPV->Move[0] = MoveStack[BestMove];
+    LocalPV->Move[0] = BestMove;
     LocalPV->Hash[0] = NewHash;
     for (int i = 0; i < NextPV.Length; i++) {
       LocalPV->Move[i+1] = NextPV.Move[i];
@@ -456,18 +1244,45 @@ int search(const position *Pos, int Ply, int Depth, int Alpha, int Beta,
   return BestVal;
 }
 
-int quiesce(const position *Pos, int Alpha, int Beta)
+int quiesce(position *Pos, int Ply, int Alpha, int Beta)
 {
-  int MvBase = getMoveStackTop();
+  movepicker Picker;
+  move Move;
   int Val;
-  int StandPat = evaluate(Pos);
-  int BestVal = StandPat;
-  int nMoves;
-  position NewPos;
+  int StandPat;
+  int BestVal;
+  undo Undo;
 
   if (timeToStop())
     return INFINITY;
 
+  // when in check there's no standing pat, so search every evasion
+  if (Pos->Flags & PF_CHECK)
+  {
+    BestVal = -INFINITY + Ply; // checkmate if there are no evasions
+    initPicker(&Picker, Pos, Ply, 0, 1);
+    while ((Move = nextMove(&Picker)) != NO_MOVE)
+    {
+      if (makeMove(Pos, Move, &Undo) == 0)
+      {
+        Nodes++;
+        Val = -quiesce(Pos, Ply+1, -Beta, -Alpha);
+        unmakeMove(Pos, Move, &Undo);
+        if (aborted())
+          return INFINITY;
+        if (Val >= Beta)
+          return Val;
+        else if (Val > Alpha)
+          Alpha = BestVal = Val;
+        else if (Val > BestVal)
+          BestVal = Val;
+      }
+    }
+    return BestVal;
+  }
+
+  StandPat = BestVal = evaluate(Pos);
+
   // check stand pat score against alpha and beta
   if (StandPat >= Beta)
     return StandPat;
@@ -479,24 +1294,22 @@ int quiesce(const position *Pos, int Alpha, int Beta)
   if (StandPat + 2*PieceVal[QUEEN] <= Alpha)
     return StandPat + 2*PieceVal[QUEEN];
 
-  // begin searching moves
-  nMoves = genCaptures(Pos);
-  for (int i = 0; i < nMoves; i++)
+  // begin searching the good captures, most valuable victims first
+  initPicker(&Picker, Pos, Ply, 0, 1);
+  while ((Move = nextMove(&Picker)) != NO_MOVE)
   {
     // determine if remaining moves can help raise alpha
-    if (MoveStack[MvBase+i].PromPc == NO_PIECE
-        && StandPat + PieceVal[MoveStack[MvBase+i].CaptPc] < Alpha)
-    {
-      return max(StandPat + PieceVal[MoveStack[MvBase+i].CaptPc], BestVal);
-    }
+    Val = StandPat + PieceVal[getCaptPc(Move)];
+    if (getPromPc(Move) == NO_PIECE && Val < Alpha)
+      return max(Val, BestVal);
 
     // search the next move
-    NewPos = *Pos;
-    if (quickMakeMove(&NewPos, MoveStack[MvBase+i]) == 0)
+    if (makeMove(Pos, Move, &Undo) == 0)
     {
       Nodes++;
-      Val = -quiesce(&NewPos, -Beta, -Alpha);
-      if (StopSearch)
+      Val = -quiesce(Pos, Ply+1, -Beta, -Alpha);
+      unmakeMove(Pos, Move, &Undo);
+      if (aborted())
         return INFINITY;
       if (Val >= Beta)
         return Val;
@@ -505,7 +1318,6 @@ int quiesce(const position *Pos, int Alpha, int Beta)
       else if (Val > BestVal)
         BestVal = Val;
     }
-    popMoveStack(MvBase + nMoves); // restore the stack for the next move
   }
 
   return BestVal;
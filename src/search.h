@@ -16,6 +16,7 @@
 
 #define MAX_SEARCH_DEPTH  32
 #define MAX_PLY (MAX_SEARCH_DEPTH*2)
+#define MAX_THREADS 64
 
 #define INFINITY  0x7fff
 #define LONG_MATE 0x7f00   
@@ -29,7 +30,8 @@ struct searchdata
   int MaxDepth;
   int64 MaxNodes;
   microtime MoveTime;
-} Search;
+};
+extern struct searchdata Search;
 #define SF_PONDER   0x01
 #define SF_INFINITE 0x02
 #define SF_STOPPED  0x80000000
@@ -44,7 +46,21 @@ struct pvdata
 
   int Length;
   move Move[MAX_PLY];
-} PVData;
+};
+extern struct pvdata PVData;
+
+/* number of searches started, used to age hash entries */
+extern uint16 Now;
+
+/* number of threads to search with, including the main thread */
+extern int SearchThreads;
+
+/* how the threads share the work */
+typedef enum smpmode {
+  SMP_LAZY,   // independent searches sharing the hash
+  SMP_YBWC,   // young brothers wait split points
+} smpmode;
+extern smpmode SMPMode;
 
 void searchRoot(void);
 
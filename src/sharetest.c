@@ -0,0 +1,134 @@
+/******************************************************************************
+ * $Id$
+ * Project: Vapor Chess
+ * Purpose: Tests sharing the hash table between processes.
+ * 
+ * Copyright 2012 by Michael Leany
+ * All rights reserved
+ */
+
+// for fork() and pread()
+#define _DEFAULT_SOURCE
+
+#include "sharetest.h"
+#include "hash.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#define SHARETEST_ROUNDS 2000       // attach/detach cycles per process
+#define SHARETEST_SIZE   0x100000   // 1MB table
+#define SHARETEST_PROCS  64         // most processes, one table slot each
+
+/******************************************************************************
+ * int attachLoop(const char *Name, int Slot);
+ * PARAMETERS
+ *    Name - name of the shared table.
+ *    Slot - the 8-byte word of the table that belongs to this process.
+ * DESCRIPTION
+ *    Attaches to and detaches from the shared table SHARETEST_ROUNDS times,
+ *    checking each time that the table reached through Name is the one this
+ *    process is attached to.
+ * RETURN VALUE
+ *    Returns the number of rounds that failed.
+ */
+static int attachLoop(const char *Name, int Slot)
+{
+  const uint64 TableSize = SHARETEST_SIZE;
+  struct stat Stat;
+  uint64 Token, Found;
+  off_t Offset;
+  int Failed = 0;
+  int i, FD;
+
+  for (i = 0; i < SHARETEST_ROUNDS; i++) {
+    if (!shareHash(Name, TableSize)) {
+      Failed++;
+      continue;
+    }
+    Token = ((uint64)getpid() << 32) | (i+1);
+    __atomic_store_n((uint64 *)HashTable + Slot, Token, __ATOMIC_SEQ_CST);
+
+    // read the slot back through the name; the table ends the shared memory
+    FD = shm_open(Name, O_RDONLY, 0);
+    if (FD < 0 || fstat(FD, &Stat) != 0) {
+      Failed++;
+    } else {
+      Offset = Stat.st_size - nHashEntries*sizeof(hash_buckets)
+          + Slot*sizeof(uint64);
+      if (pread(FD, &Found, sizeof(Found), Offset) != sizeof(Found)
+          || Found != Token) {
+        Failed++;
+      }
+    }
+    if (FD >= 0) {
+      close(FD);
+    }
+    freeHash();
+  }
+
+  return Failed;
+}
+
+int sharetest(int nProcs)
+{
+  char Name[64];
+  pid_t Pids[SHARETEST_PROCS];
+  int Status;
+  int Failed = 0;
+  int i, FD;
+
+  nProcs = min(max(nProcs, 2), SHARETEST_PROCS);
+  snprintf(Name, sizeof(Name), "/vapor-sharetest-%i", (int)getpid());
+  shm_unlink(Name);
+  freeHash();
+
+  printf("\nProcesses: %i \tRounds: %i\n", nProcs, SHARETEST_ROUNDS);
+  fflush(stdout);
+  for (i = 0; i < nProcs; i++) {
+    Pids[i] = fork();
+    if (Pids[i] == 0) {
+      Failed = attachLoop(Name, i);
+      if (Failed) {
+        printf("Process %i: %i of %i rounds failed\n", i, Failed,
+            SHARETEST_ROUNDS);
+      }
+      fflush(stdout);
+      _exit(Failed? 1 : 0);
+    } else if (Pids[i] < 0) {
+      fprintf(stderr, "Cannot start process %i\n", i);
+      nProcs = i;
+      Failed = 1;
+      break;
+    }
+  }
+
+  for (i = 0; i < nProcs; i++) {
+    if (waitpid(Pids[i], &Status, 0) != Pids[i] || !WIFEXITED(Status)
+        || WEXITSTATUS(Status) != 0) {
+      Failed = 1;
+    }
+  }
+
+  // the last process to detach removes the shared memory
+  FD = shm_open(Name, O_RDONLY, 0);
+  if (FD >= 0 || errno != ENOENT) {
+    printf("Shared memory %s was left behind\n", Name);
+    if (FD >= 0) {
+      close(FD);
+    }
+    shm_unlink(Name);
+    Failed = 1;
+  }
+
+  printf("Shared hash test %s.\n", Failed? "failed" : "passed");
+  return Failed;
+}
+
+/* end of file */
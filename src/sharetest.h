@@ -0,0 +1,32 @@
+/******************************************************************************
+ * $Id$
+ * Project: Vapor Chess
+ * Purpose: Tests sharing the hash table between processes.
+ * 
+ * Copyright 2012 by Michael Leany
+ * All rights reserved
+ */
+
+#ifndef VAPOR__SHARETEST_H
+#define VAPOR__SHARETEST_H
+
+#include "vapor.h"
+
+/******************************************************************************
+ * int sharetest(int nProcs);
+ * PARAMETERS
+ *    nProcs - the number of processes to run at once.
+ * DESCRIPTION
+ *    Starts nProcs processes that each attach to and detach from the same
+ *    shared hash table over and over. While attached, each writes to its own
+ *    slot of the table and reads the slot back through the table's name, so
+ *    a process left on a table that the name no longer leads to is caught.
+ *    Once they are done, the shared memory must have been removed.
+ * RETURN VALUE
+ *    Returns 0 upon success or 1 upon failure.
+ */
+int sharetest(int nProcs);
+
+#endif // #ifndef VAPOR__SHARETEST_H
+
+/* end of file */
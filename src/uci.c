@@ -201,6 +201,130 @@ static void uciCheckInput(void)
   }
 }
 
+static const uint64 MEGABYTE = 0x100000;
+static uint64 HashMB = 256;
+static char HashFile[FILENAME_MAX] = "vapor.hash";
+static char SharedHash[256] = ""; // shared memory name, if the hash is shared
+static int HashIsShared = 0; // the table in use is the shared one
+static int LoadPending = 0; // "Load Hash from File" was sent before isready
+static int KeepHash = 0;    // a loaded table survives the next ucinewgame
+
+/******************************************************************************
+ * void allocateHash(void);
+ * DESCRIPTION
+ *    (Re)allocates the hash table with the size from the Hash option, or
+ *    attaches to the shared hash table named by the Shared Hash option,
+ *    falling back to a private table if that fails.
+ * RETURN VALUE
+ *    Does not return a value.
+ */
+static void allocateHash(void)
+{
+  if (SharedHash[0]) {
+    if (shareHash(SharedHash, HashMB * MEGABYTE)) {
+      HashIsShared = 1;
+      printf("info string sharing hash of %iMB as %s\n",
+          (int)(nHashEntries*sizeof(hash_buckets)/MEGABYTE), SharedHash);
+      return;
+    }
+    // search with a private table rather than with none at all
+    printf("info string cannot share hash as %s\n", SharedHash);
+  }
+
+  HashIsShared = 0;
+  if (!resizeHash(HashMB * MEGABYTE, SearchThreads) && HashMB) {
+    printf("info string cannot allocate hash of %iMB\n", (int)HashMB);
+  } else {
+    printf("info string allocated hash of %iMB\n",
+        (int)(nHashEntries*sizeof(hash_buckets)/MEGABYTE));
+  }
+}
+
+/******************************************************************************
+ * int loadHashFile(void);
+ * DESCRIPTION
+ *    Replaces the hash table with the one saved in the file named by the Hash
+ *    File option, keeping it through the next ucinewgame, since a GUI will
+ *    usually send one before the game the table was loaded for.
+ * RETURN VALUE
+ *    Returns 0 for success or -1 for failure, leaving the old table in place.
+ */
+static int loadHashFile(void)
+{
+  if (!loadHash(HashFile, &Now)) {
+    printf("info string cannot load hash from %s\n", HashFile);
+    return -1;
+  }
+  HashMB = nHashEntries*sizeof(hash_buckets)/MEGABYTE;
+  HashIsShared = 0;
+  KeepHash = 1;
+  printf("info string loaded hash of %iMB\n", (int)HashMB);
+  return 0;
+}
+
+/******************************************************************************
+ * void parseSetOptionCmd(int Ready);
+ * PARAMETERS
+ *    Ready -- non-zero once the engine has been initialized, so that changes
+ *        to the hash take effect right away. Before then, loading a hash file
+ *        waits until the table is allocated.
+ * DESCRIPTION
+ *    Parses and executes the "setoption" command.
+ * RETURN VALUE
+ *    Does not return a value.
+ */
+static void parseSetOptionCmd(int Ready)
+{
+  int i;
+
+  if (!Args[1] || strcmp(Args[1], "name") != 0)
+    return;
+
+  // find "value" keyword
+  for (i = 2; i < nArgs; i++)
+  {
+    if (strcmp(Args[i], "value") == 0)
+      break;
+  }
+  joinArgs(i+1, nArgs-1); // join value
+  joinArgs(2, i-1);       // join name
+  if (Args[2] && lcmatch(Args[2], "Hash") && Args[4]) {
+    HashMB = max(atoi(Args[4]), 0);
+    if (Ready)
+      allocateHash();
+  } else if (Args[2] && lcmatch(Args[2], "Clear Hash")) {
+    if (Ready)
+      clearHash(SearchThreads);
+    else
+      printf("info string no hash to clear before isready\n");
+  } else if (Args[2] && lcmatch(Args[2], "Hash File") && Args[4]) {
+    snprintf(HashFile, sizeof(HashFile), "%s", Args[4]);
+  } else if (Args[2] && lcmatch(Args[2], "Shared Hash")) {
+    // shared memory names start with a single '/'
+    if (!Args[4] || strcmp(Args[4], "<empty>") == 0)
+      SharedHash[0] = '\0';
+    else
+      snprintf(SharedHash, sizeof(SharedHash), "/%s",
+          Args[4] + (Args[4][0] == '/'));
+    if (Ready)
+      allocateHash();
+  } else if (Args[2] && lcmatch(Args[2], "Save Hash to File")) {
+    if (!Ready)
+      printf("info string no hash to save before isready\n");
+    else if (saveHash(HashFile, Now) != 0)
+      printf("info string cannot save hash to %s\n", HashFile);
+  } else if (Args[2] && lcmatch(Args[2], "Load Hash from File")) {
+    if (Ready)
+      loadHashFile();
+    else
+      LoadPending = 1;
+  } else if (Args[2] && lcmatch(Args[2], "Threads") && Args[4]) {
+    SearchThreads = min(max(atoi(Args[4]), 1), MAX_THREADS);
+  } else if (Args[2] && lcmatch(Args[2], "SMP Mode") && Args[4]) {
+    SMPMode = lcmatch(Args[4], "YBWC")? SMP_YBWC : SMP_LAZY;
+  }
+}
+
 /******************************************************************************
  * int ucimain(void);
  * DESCRIPTION
@@ -210,14 +334,10 @@ static void uciCheckInput(void)
  */
 int ucimain(void)
 {
-  static const uint64 MEGABYTE = 0x100000;
   const char *CmdStr;
   command Cmd = NO_CMD;
   int i;
 
-  uint64 HashMB = 256;
-
-
   while (Cmd != C_UCI)
   {
     CmdStr = readLine();
@@ -232,6 +352,14 @@ int ucimain(void)
   printf("id author %s\n", VER.AuthorName);
   printf("option name Ponder type check\n");
   printf("option name Hash type spin default %"_u64" min 0\n", HashMB);
+  printf("option name Clear Hash type button\n");
+  printf("option name Hash File type string default %s\n", HashFile);
+  printf("option name Shared Hash type string default <empty>\n");
+  printf("option name Save Hash to File type button\n");
+  printf("option name Load Hash from File type button\n");
+  printf("option name Threads type spin default %i min 1 max %i\n",
+      SearchThreads, MAX_THREADS);
+  printf("option name SMP Mode type combo default Lazy var Lazy var YBWC\n");
   printf("uciok\n");
 
   while (Cmd != C_ISREADY)
@@ -241,32 +369,16 @@ int ucimain(void)
     Cmd = findCmd(Args[0]);
     if (Cmd == C_SETOPTION)
     {
-      if (Args[1] && strcmp(Args[1], "name") == 0)
-      {
-        // find "value" keyword
-        for (i = 2; i < nArgs; i++)
-        {
-          if (strcmp(Args[i], "value") == 0)
-            break;
-        }
-        joinArgs(i+1, nArgs-1); // join value
-        joinArgs(2, i-1);       // join name
-        if (Args[2] && lcmatch(Args[2], "Hash") && Args[4]) {
-          HashMB = atoi(Args[4]);
-        }
-      }
+      parseSetOptionCmd(0);
     } else if (Cmd == C_QUIT) {
       return 0;
     }
   }
 
   init();
-  if (HashMB && !initHash(HashMB * MEGABYTE)) {
-    printf("info string cannot allocate hash of %iMB\n", (int)HashMB);
-  } else {
-    printf("info string allocated hash of %iMB\n",
-        (int)(nHashEntries*sizeof(hash_buckets)/MEGABYTE));
-  }
+  // a hash file loaded before isready takes the place of the first table
+  if (!LoadPending || loadHashFile() != 0)
+    allocateHash();
   printPV = uciPrintPV;
   checkInput = uciCheckInput;
 
@@ -318,9 +430,22 @@ int ucimain(void)
       } break;
 
       case C_GO:
+        KeepHash = 0;
         parseGoCmd();
         break;
 
+      case C_SETOPTION:
+        parseSetOptionCmd(1);
+        break;
+
+      case C_UCINEWGAME:
+        // a shared hash is left for the other processes using it, and a
+        // freshly loaded one for the game it was loaded for
+        if (!HashIsShared && !KeepHash)
+          clearHash(SearchThreads);
+        KeepHash = 0;
+        break;
+
       default:
         break;
     }
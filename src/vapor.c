@@ -13,6 +13,9 @@
 #include "version.h"
 #include "mgtest.h"
 #include "init.h"
+#include "bench.h"
+#include "search.h"
+#include "sharetest.h"
 
 #include <stdio.h>
 #include <getopt.h>
@@ -35,6 +38,10 @@ int findCommand(const char *Command) {
     "perft",
     "vcount",
     "mgtest",
+    "slidertest",
+    "bench",
+    "evalbench",
+    "sharetest",
     NULL
   };
 
@@ -49,6 +56,10 @@ int findCommand(const char *Command) {
 #define PERFTEST  1
 #define VCOUNT    2
 #define MGTEST    3
+#define SLIDERTEST 4
+#define BENCH     5
+#define EVALBENCH 6
+#define SHARETEST 7
 
 /******************************************************************************
  * int main(int ArgC, char **ArgV);
@@ -73,10 +84,17 @@ int main(int ArgC, char **ArgV)
     { "fen", required_argument, NULL, 'f' },
     { "depth", required_argument, NULL, 'd' },
     { "epdfile", required_argument, NULL, 'e' },
+    { "hash", required_argument, NULL, 'm' },
+    { "threads", required_argument, NULL, 't' },
+    { "jobs", required_argument, NULL, 'j' },
+    { "smp", required_argument, NULL, 's' },
     { 0, 0, 0, 0 }
   };
 
   int Depth = 0;
+  uint64 HashMB = 0;
+  int Threads = 1;
+  int Jobs = 1;
   char *EPDFile = NULL;
   char *Fen = NULL;
 
@@ -138,7 +156,7 @@ int main(int ArgC, char **ArgV)
         Fen = optarg;
         break;
       case 'd': // depth
-        if (CmdCode != PERFTEST && CmdCode != VCOUNT) {
+        if (CmdCode != PERFTEST && CmdCode != VCOUNT && CmdCode != BENCH) {
           fflush(stdout);
           fprintf(stderr, "%s: '--%s' option not valid in this context\n",
               Prog, LongOptions[LongIndex].name);
@@ -160,6 +178,71 @@ int main(int ArgC, char **ArgV)
         }
         EPDFile = optarg;
         break;
+      case 'm': // hash
+        if (CmdCode != PERFTEST && CmdCode != VCOUNT) {
+          fflush(stdout);
+          fprintf(stderr, "%s: '--%s' option not valid in this context\n",
+              Prog, LongOptions[LongIndex].name);
+          return 1;
+        }
+        if (atoi(optarg) < 0) {
+          fflush(stdout);
+          fprintf(stderr, "%s: hash size must not be negative\n", Prog);
+          return 1;
+        }
+        HashMB = atoi(optarg);
+        break;
+      case 't': // threads
+        if (CmdCode != PERFTEST && CmdCode != VCOUNT && CmdCode != BENCH) {
+          fflush(stdout);
+          fprintf(stderr, "%s: '--%s' option not valid in this context\n",
+              Prog, LongOptions[LongIndex].name);
+          return 1;
+        }
+        Threads = atoi(optarg);
+        if (Threads < 1) {
+          fflush(stdout);
+          fprintf(stderr, "%s: threads must be a positive integer\n", Prog);
+          return 1;
+        }
+        if (CmdCode == BENCH && Threads > MAX_THREADS) {
+          fflush(stdout);
+          fprintf(stderr, "%s: at most %i threads are supported\n", Prog,
+              MAX_THREADS);
+          return 1;
+        }
+        break;
+      case 's': // smp
+        if (CmdCode != BENCH) {
+          fflush(stdout);
+          fprintf(stderr, "%s: '--%s' option not valid in this context\n",
+              Prog, LongOptions[LongIndex].name);
+          return 1;
+        }
+        if (strcmp(optarg, "lazy") == 0)
+          SMPMode = SMP_LAZY;
+        else if (strcmp(optarg, "ybwc") == 0)
+          SMPMode = SMP_YBWC;
+        else {
+          fflush(stdout);
+          fprintf(stderr, "%s: smp mode must be 'lazy' or 'ybwc'\n", Prog);
+          return 1;
+        }
+        break;
+      case 'j': // jobs
+        if (CmdCode != MGTEST && CmdCode != SHARETEST) {
+          fflush(stdout);
+          fprintf(stderr, "%s: '--%s' option not valid in this context\n",
+              Prog, LongOptions[LongIndex].name);
+          return 1;
+        }
+        Jobs = atoi(optarg);
+        if (Jobs < 1) {
+          fflush(stdout);
+          fprintf(stderr, "%s: jobs must be a positive integer\n", Prog);
+          return 1;
+        }
+        break;
       case 'x':
         fflush(stdout);
         fprintf(stderr,
@@ -198,7 +281,7 @@ int main(int ArgC, char **ArgV)
           fprintf(stderr, "%s: depth not specified\n", Command);
           return 1;
         }
-        return perftest(Fen, Depth);
+        return perftest(Fen, Depth, HashMB, Threads);
 
       case VCOUNT:
         if (Depth < 1) {
@@ -206,7 +289,7 @@ int main(int ArgC, char **ArgV)
           fprintf(stderr, "%s: depth not specified\n", Command);
           return 1;
         }
-        return printVariations(Fen, Depth);
+        return printVariations(Fen, Depth, HashMB, Threads);
 
       case MGTEST:
         if (!EPDFile) {
@@ -214,7 +297,19 @@ int main(int ArgC, char **ArgV)
           fprintf(stderr, "%s: no epd file specified\n", Command);
           return 1;
         }
-        return mgtest(EPDFile);
+        return mgtest(EPDFile, Jobs);
+
+      case SLIDERTEST:
+        return slidertest();
+
+      case BENCH:
+        return bench(Depth? Depth : BENCH_DEPTH, Threads);
+
+      case EVALBENCH:
+        return evalBench();
+
+      case SHARETEST:
+        return sharetest(Jobs > 1? Jobs : 4);
 
       default:
         return 1;
@@ -67,6 +67,9 @@ typedef uint64_t uint64;
 #define asm __asm__
 #endif // #ifdef __GNUC__
 
+/* storage class for variables that each thread has its own copy of */
+#define THREAD_LOCAL __thread
+
 static inline int max(int a, int b)
 {
   return (a>b)?a:b;
@@ -365,4 +365,22 @@ zobrist calcZobrist(const position *Pos) {
   return Key;
 }
 
+zobrist calcPawnZobrist(const position *Pos) {
+  zobrist Key = 0;
+  bitboard Bd;
+  color c;
+  square s;
+
+  for (c = BLACK; c < NUM_COLORS; c++) {
+    Bd = Pos->OccBy[c][PAWN];
+    while (Bd) {
+      s = firstSq(Bd);
+      Key ^= Z_PLACEMENT[c][PAWN][s];
+      TOGGLESQ(Bd, s);
+    }
+  }
+
+  return Key;
+}
+
 /* end of file */
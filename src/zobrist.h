@@ -19,6 +19,7 @@ extern const zobrist Z_CASTLE[16];
 extern const zobrist Z_WHITEMOVE;
 
 zobrist calcZobrist(const position *Pos);
+zobrist calcPawnZobrist(const position *Pos);
 
 #endif // #ifndef VAPOR__ZOBRIST_H
 
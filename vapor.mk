@@ -26,6 +26,13 @@ verflags := -D BUILD_TYPE=\"$(buildtype)\" -D REVISION=\"$(revision)\" \
 #	-MP		Include phony targets for headers files in dependency file.
 CPPFLAGS := -MMD -MP $(CPPFLAGS)
 
+# Hash Table Options
+#	COMPACT_HASH	Store 6 positions per cache line instead of 4, keeping
+#					only 16 bits of each key (make COMPACT_HASH=1).
+ifdef COMPACT_HASH
+CPPFLAGS := -D COMPACT_HASH $(CPPFLAGS)
+endif
+
 # C Warning Options
 CFLAGS := -Wall -Werror-implicit-function-declaration -Winit-self \
 	-Wwrite-strings -Wstrict-prototypes -Wextra -Wno-unused-parameter \
@@ -38,6 +45,14 @@ CFLAGS := -std=c99 $(CFLAGS)
 CFLAGS := $(ARCHFLAGS) $(CFLAGS)
 LDFLAGS := $(ARCHFLAGS)
 
+# Threading Options
+CFLAGS := -pthread $(CFLAGS)
+LDFLAGS := -pthread $(LDFLAGS)
+
+# Libraries
+#	-lrt	shm_open() for shared hash tables, on older C libraries.
+LDLIBS := -lrt $(LDLIBS)
+
 all: $(executable)
 	@echo Build complete.
 